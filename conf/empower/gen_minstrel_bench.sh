@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# generate bench-minstrel-stats.click, which measures the periodic
+# statistics update of Minstrel for a given number of neighbours
+#
+# usage: gen_minstrel_bench.sh [neighbours] > bench-minstrel-stats.click
+#
+
+N=${1:-100}
+
+cat <<EOF
+// bench-minstrel-stats.click, generated by gen_minstrel_bench.sh $N
+
+// Measures the periodic statistics update of Minstrel with $N HT
+// neighbours. Every neighbour has its own transmission policy and
+// source of FRAMES unicast data frames, which are fed back to Minstrel as
+// transmitted. After one second the update counters are cleared, and
+// after another TIME seconds the number of updates and the time they took
+// are printed.
+
+// Run with
+//    click bench-minstrel-stats.click [TIME=secs] [PERIOD=msecs] [FRAMES=n]
+
+// With PERIOD 0 the update runs back to back once the frames are sent,
+// which gives its cost with warm caches. PERIOD=100 FRAMES=-1 gives the
+// cost on an agent that keeps transmitting to every neighbour.
+
+define(\$TIME 10, \$PERIOD 0, \$FRAMES 200);
+
+tp_ht :: TransmissionPolicy(MCS "2 4 11 22", HT_MCS "0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15");
+
+tp :: TransmissionPolicies(DEFAULT tp_ht,
+EOF
+
+i=1
+while [ $i -le $N ]; do
+	sep=","
+	[ $i -eq $N ] && sep=");"
+	printf "                          02:00:00:00:%02x:%02x tp_ht%s\n" $((i / 256)) $((i % 256)) "$sep"
+	i=$((i + 1))
+done
+
+cat <<EOF
+
+rc :: Minstrel(OFFSET 4, TP tp, PERIOD \$PERIOD);
+
+rc [0] -> [1] rc [1] -> Discard;
+
+EOF
+
+i=1
+while [ $i -le $N ]; do
+	printf "InfiniteSource(DATA \\\\<08 02 00 00 02 00 00 00 %02x %02x 0a 00 00 00 00 01 0a 00 00 00 00 01 00 00 aa aa 03 00 00 00 08 00>, LIMIT \$FRAMES, BURST 1) -> rc;\n" $((i / 256)) $((i % 256))
+	i=$((i + 1))
+done
+
+cat <<EOF
+
+DriverManager(wait 1s,
+	      write rc.update_time,
+	      wait \$TIME,
+	      print rc.update_time,
+	      stop);
+EOF
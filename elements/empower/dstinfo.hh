@@ -9,6 +9,9 @@
 #include "sma.hh"
 CLICK_DECLS
 
+// upper bound on the SMA_PERIOD of EmpowerRXStats
+#define DSTINFO_SMA_MAX_PERIOD 64
+
 class DstInfo {
 public:
 	EtherAddress _eth;
@@ -19,7 +22,7 @@ public:
 	int _last_rssi;
 	int _last_std;
 	int _last_packets;
-	SMA *_sma_rssi;
+	SMA<DSTINFO_SMA_MAX_PERIOD> _sma_rssi;
 	unsigned _silent_window_count;
 	int _hist_packets;
 	int _iface_id;
@@ -28,7 +31,6 @@ public:
 	DstInfo() {
 		_eth = EtherAddress();
 		_sender_type = 0;
-		_sma_rssi = 0;
 		_accum_rssi = 0;
 		_squares_rssi = 0;
 		_silent_window_count = 0;
@@ -40,10 +42,6 @@ public:
 		_iface_id = -1;
 	}
 
-	~DstInfo() {
-		delete _sma_rssi;
-	}
-
 	void update() {
 		_hist_packets += _packets;
 		_last_rssi = (_packets > 0) ? _accum_rssi / (double) _packets : 0;
@@ -53,18 +51,20 @@ public:
 			_silent_window_count++;
 		} else {
 			_silent_window_count = 0;
-			_sma_rssi->add(_last_rssi);
+			_sma_rssi.add(_last_rssi);
 		}
 		_packets = 0;
 		_accum_rssi = 0;
 		_squares_rssi = 0;
 	}
 
-	void add_sample(uint8_t rssi) {
-		_packets++;
-		_accum_rssi += rssi;
-		_squares_rssi += rssi * rssi;
-		_last_received.assign_now();
+	void add_samples(int packets, int accum_rssi, int squares_rssi, const Timestamp &last_received) {
+		_packets += packets;
+		_accum_rssi += accum_rssi;
+		_squares_rssi += squares_rssi;
+		if (_last_received < last_received) {
+			_last_received = last_received;
+		}
 	}
 
 	String unparse() {
@@ -73,7 +73,7 @@ public:
 		Timestamp age = now - _last_received;
 		sa << _eth.unparse();
 		sa << (_sender_type == 0 ? " STA" : " AP");
-		sa << " sma_rssi " << _sma_rssi->avg();
+		sa << " sma_rssi " << _sma_rssi.avg();
 		sa << " last_rssi_avg " << _last_rssi;
 		sa << " last_rssi_std " << _last_std;
 		sa << " last_packets " << _last_packets;
@@ -398,6 +398,12 @@ void EmpowerAssociationResponder::push(int, Packet *p) {
 		return;
 	}
 
+	// remember the longest A-MSDU the station can receive
+	ess->_max_amsdu_length = 3839;
+	if (htcaps && (((struct click_wifi_ht_caps *) htcaps)->ht_caps_info & WIFI_HT_CI_HT_MAX_AMSDU)) {
+		ess->_max_amsdu_length = 7935;
+	}
+
 	// always ask to the controller because we may want to reject this request
 	if (htcaps && (ess->_band == EMPOWER_BT_HT20)) {
 		_el->send_association_request(src, bssid, ssid, ess->_hwaddr, ess->_channel, ess->_band, EMPOWER_BT_HT20);
@@ -29,10 +29,14 @@
 CLICK_DECLS
 
 EmpowerBeaconSource::EmpowerBeaconSource() :
-		_el(0), _period(500), _timer(this), _debug(false) {
+		_el(0), _period(500), _timer(this), _slots(10), _burst(16), _crr_slot(0),
+		_unqueued(0), _deferred(0), _overloaded(0), _reports_dropped(0), _forwarded(0),
+		_limited(0), _probe_rate(10), _probe_burst(1), _report_period(100),
+		_report_timer(this), _debug(false) {
 }
 
 EmpowerBeaconSource::~EmpowerBeaconSource() {
+	clear_templates();
 }
 
 int EmpowerBeaconSource::configure(Vector<String> &conf, ErrorHandler *errh) {
@@ -40,8 +44,33 @@ int EmpowerBeaconSource::configure(Vector<String> &conf, ErrorHandler *errh) {
 	int ret = Args(conf, this, errh)
               .read_m("EL", ElementCastArg("EmpowerLVAPManager"), _el)
 			  .read("PERIOD", _period)
+			  .read("SLOTS", _slots)
+			  .read("BURST", _burst)
+			  .read("REPORT_PERIOD", _report_period)
+			  .read("PROBE_RATE", _probe_rate)
+			  .read("PROBE_BURST", _probe_burst)
 			  .read("DEBUG", _debug).complete();
 
+	if (_slots == 0 || _slots > _period) {
+		return errh->error("SLOTS must be between 1 and PERIOD");
+	}
+
+	if (_burst == 0) {
+		return errh->error("BURST must be positive");
+	}
+
+	if (_report_period == 0) {
+		return errh->error("REPORT_PERIOD must be positive");
+	}
+
+	if (_probe_burst == 0) {
+		return errh->error("PROBE_BURST must be positive");
+	}
+
+	_probe_token_rate.assign(_probe_rate, _probe_burst);
+
+	_wheel.resize(_slots);
+
 	return ret;
 
 }
@@ -49,33 +78,155 @@ int EmpowerBeaconSource::configure(Vector<String> &conf, ErrorHandler *errh) {
 int EmpowerBeaconSource::initialize(ErrorHandler *) {
 	_timer.initialize(this);
 	_timer.schedule_now();
+	_report_timer.initialize(this);
+	_report_timer.schedule_after_msec(_report_period);
 	return 0;
 }
 
-void EmpowerBeaconSource::run_timer(Timer *) {
+void EmpowerBeaconSource::run_timer(Timer *timer) {
+
+	if (timer == &_report_timer) {
+		flush_reports();
+		_report_timer.reschedule_after_msec(_report_period);
+		return;
+	}
+
+	// a new beacon interval starts, the backlog is always empty
+	// here since the last slot sends everything that is left
+	if (_crr_slot == 0) {
+		update_wheel();
+		_unqueued = _slot_table.size();
+	}
+
+	Vector<BeaconTarget> &slot = _wheel[_crr_slot];
+
+	for (int i = 0; i < slot.size(); i++) {
+		_backlog.push_back(slot[i]);
+	}
+
+	_unqueued -= slot.size();
 
-	// send LVAP beacon
+	// send at most BURST beacons, unless the beacons left in this
+	// interval would not fit in the remaining slots
+	unsigned slots_left = _slots - _crr_slot;
+	unsigned budget = (_backlog.size() + _unqueued + slots_left - 1) / slots_left;
+
+	if (budget > _burst) {
+		_overloaded++;
+	} else {
+		budget = _burst;
+	}
+
+	unsigned sent = 0;
+
+	while (_backlog.size() && sent < budget) {
+		BeaconTarget target = _backlog.front();
+		_backlog.pop_front();
+		send_target(target);
+		sent++;
+	}
+
+	// targets deferred earlier are at the front of the backlog and
+	// have been sent first, only count the ones of this slot
+	_deferred += _backlog.size() < slot.size() ? _backlog.size() : slot.size();
+
+	_crr_slot = (_crr_slot + 1) % _slots;
+
+	// schedule the next slot
+	_timer.reschedule_after(Timestamp::make_usec(_period * 1000 / _slots));
+
+}
+
+/*
+ * Assigns every LVAP network and every VAP to a slot of the beacon
+ * wheel. Targets keep their slot across intervals so that beacons
+ * are sent at a regular pace, new targets go to the least loaded slot.
+ */
+void EmpowerBeaconSource::update_wheel() {
+
+	BeaconSlots targets;
+	Vector<uint32_t> load(_slots, 0);
+
+	// LVAP beacons
 	for (LVAPIter it = _el->lvaps()->begin(); it.live(); it++) {
 		for (int i = 0; i < it.value()._networks.size(); i++) {
-			EtherAddress bssid = it.value()._networks[i]._bssid;
-			String ssid = it.value()._networks[i]._ssid;
-			if (it.value()._bssid == bssid && it.value()._ssid == ssid && it.value()._csa_active) {
-				send_lvap_csa_beacon(&it.value());
-			} else {
-				send_beacon(it.value()._sta, bssid, ssid, it.value()._channel, it.value()._iface_id, false, false, 0, 0, 0);
-			}
+			targets.set(BeaconTarget(it.value()._sta, it.value()._networks[i]._bssid), -1);
 		}
 	}
 
-	// send VAP beacons
+	// VAP beacons
 	for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-		send_beacon(EtherAddress::make_broadcast(), it.value()._bssid,
-				it.value()._ssid, it.value()._channel, it.value()._iface_id,
-				false, false, 0, 0, 0);
+		targets.set(BeaconTarget(EtherAddress::make_broadcast(), it.value()._bssid), -1);
 	}
 
-	// re-schedule the timer with some jitter
-	_timer.schedule_after_msec(_period);
+	// keep the slots of the known targets
+	for (BSIter it = targets.begin(); it.live(); it++) {
+		BSIter old = _slot_table.find(it.key());
+		if (old != _slot_table.end()) {
+			it.value() = old.value();
+			load[old.value()]++;
+		}
+	}
+
+	// assign new targets to the least loaded slot
+	for (BSIter it = targets.begin(); it.live(); it++) {
+		if (it.value() >= 0) {
+			continue;
+		}
+		unsigned min = 0;
+		for (unsigned i = 1; i < _slots; i++) {
+			if (load[i] < load[min]) {
+				min = i;
+			}
+		}
+		it.value() = min;
+		load[min]++;
+	}
+
+	_slot_table.swap(targets);
+
+	for (unsigned i = 0; i < _slots; i++) {
+		_wheel[i].clear();
+	}
+
+	for (BSIter it = _slot_table.begin(); it.live(); it++) {
+		_wheel[it.value()].push_back(it.key());
+	}
+
+}
+
+void EmpowerBeaconSource::send_target(const BeaconTarget &target) {
+
+	// VAP beacon
+	if (target._dst.is_broadcast()) {
+		EmpowerVAPState *vap = _el->vaps()->get_pointer(target._bssid);
+		if (vap) {
+			send_beacon(EtherAddress::make_broadcast(), vap->_bssid, vap->_ssid,
+					vap->_channel, vap->_iface_id, false, false, 0, 0, 0);
+		}
+		return;
+	}
+
+	// LVAP beacon, the LVAP may have been removed in the meantime
+	EmpowerStationState *ess = _el->get_ess(target._dst);
+
+	if (!ess) {
+		return;
+	}
+
+	for (int i = 0; i < ess->_networks.size(); i++) {
+		EtherAddress bssid = ess->_networks[i]._bssid;
+		String ssid = ess->_networks[i]._ssid;
+		if (bssid != target._bssid) {
+			continue;
+		}
+		if (ess->_bssid == bssid && ess->_ssid == ssid && ess->_csa_active) {
+			send_lvap_csa_beacon(ess);
+		} else {
+			send_beacon(ess->_sta, bssid, ssid, ess->_channel, ess->_iface_id, false, false, 0, 0, 0);
+		}
+		return;
+	}
 
 }
 
@@ -129,6 +280,112 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 					  iface_id);
 	}
 
+	_templates_lock.acquire_write();
+
+	BeaconTemplate *tmpl = lookup_template(bssid, ssid, channel, iface_id, probe, csa_active, csa_mode, csa_channel);
+
+	if (!tmpl) {
+		tmpl = build_template(bssid, ssid, channel, iface_id, probe, csa_active, csa_mode, csa_channel);
+		if (!tmpl) {
+			_templates_lock.release_write();
+			click_chatter("%{element} :: %s :: cannot make packet!",
+					      this,
+					      __func__);
+			return;
+		}
+		_templates[bssid].push_back(tmpl);
+	}
+
+	WritablePacket *p = Packet::make(tmpl->_p->data(), tmpl->_p->length());
+	int csa_count_offset = tmpl->_csa_count_offset;
+
+	_templates_lock.release_write();
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+				      this,
+				      __func__);
+		return;
+	}
+
+	struct click_wifi *w = (struct click_wifi *) p->data();
+	memcpy(w->i_addr1, dst.data(), 6);
+
+	if (csa_count_offset > 0) {
+		p->data()[csa_count_offset] = (uint8_t) csa_count;
+	}
+
+	SET_PAINT_ANNO(p, iface_id);
+	output(0).push(p);
+
+}
+
+BeaconTemplate *
+EmpowerBeaconSource::lookup_template(EtherAddress bssid, String ssid,
+		int channel, int iface_id, bool probe, bool csa_active, int csa_mode,
+		int csa_channel) {
+
+	BeaconTemplates::iterator it = _templates.find(bssid);
+
+	if (it == _templates.end()) {
+		return 0;
+	}
+
+	for (int i = 0; i < it.value().size(); i++) {
+		BeaconTemplate *tmpl = it.value()[i];
+		if (tmpl->_ssid != ssid || tmpl->_channel != channel ||
+				tmpl->_iface_id != iface_id || tmpl->_probe != probe ||
+				tmpl->_csa_active != csa_active) {
+			continue;
+		}
+		if (csa_active && (tmpl->_csa_mode != csa_mode || tmpl->_csa_channel != csa_channel)) {
+			continue;
+		}
+		return tmpl;
+	}
+
+	return 0;
+
+}
+
+void EmpowerBeaconSource::invalidate_templates(EtherAddress bssid) {
+
+	_templates_lock.acquire_write();
+
+	BeaconTemplates::iterator it = _templates.find(bssid);
+
+	if (it != _templates.end()) {
+		for (int i = 0; i < it.value().size(); i++) {
+			delete it.value()[i];
+		}
+		_templates.erase(it);
+	}
+
+	_templates_lock.release_write();
+
+}
+
+void EmpowerBeaconSource::clear_templates() {
+
+	_templates_lock.acquire_write();
+
+	for (BeaconTemplates::iterator it = _templates.begin(); it.live(); it++) {
+		for (int i = 0; i < it.value().size(); i++) {
+			delete it.value()[i];
+		}
+	}
+
+	_templates.clear();
+
+	_templates_lock.release_write();
+
+}
+
+BeaconTemplate *
+EmpowerBeaconSource::build_template(EtherAddress bssid, String ssid,
+		int channel, int iface_id, bool probe, bool csa_active, int csa_mode,
+		int csa_channel) {
+
 	/* order elements by standard
 	 * needed by sloppy 802.11b driver implementations
 	 * to be able to connect to 802.11g APs
@@ -154,15 +411,23 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 	}
 
 	WritablePacket *p = Packet::make(max_len);
-	memset(p->data(), 0, p->length());
 
 	if (!p) {
-		click_chatter("%{element} :: %s :: cannot make packet!",
-				      this,
-				      __func__);
-		return;
+		return 0;
 	}
 
+	memset(p->data(), 0, p->length());
+
+	BeaconTemplate *tmpl = new BeaconTemplate();
+	tmpl->_ssid = ssid;
+	tmpl->_channel = channel;
+	tmpl->_iface_id = iface_id;
+	tmpl->_probe = probe;
+	tmpl->_csa_active = csa_active;
+	tmpl->_csa_mode = csa_mode;
+	tmpl->_csa_channel = csa_channel;
+	tmpl->_csa_count_offset = -1;
+
 	struct click_wifi *w = (struct click_wifi *) p->data();
 
 	w->i_fc[0] = WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_MGT;
@@ -174,7 +439,8 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 
 	w->i_fc[1] = WIFI_FC1_DIR_NODS;
 
-    memcpy(w->i_addr1, dst.data(), 6);
+	/* destination is patched when the template is sent */
+	memset(w->i_addr1, 0xff, 6);
 	memcpy(w->i_addr2, bssid.data(), 6);
 	memcpy(w->i_addr3, bssid.data(), 6);
 
@@ -255,7 +521,8 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 		ptr[1] = 3; // length
 		ptr[2] = (uint8_t) csa_mode;
 		ptr[3] = (uint8_t) csa_channel;
-		ptr[4] = (uint8_t) csa_count;
+		ptr[4] = 0; // count, patched when the template is sent
+		tmpl->_csa_count_offset = ptr + 4 - p->data();
 		ptr += 2 + 3;
 		actual_length += 2 + 3;
 	}
@@ -358,8 +625,9 @@ void EmpowerBeaconSource::send_beacon(EtherAddress dst, EtherAddress bssid,
 	}
 
 	p->take(max_len - actual_length);
-	SET_PAINT_ANNO(p, iface_id);
-	output(0).push(p);
+	tmpl->_p = p;
+
+	return tmpl;
 
 }
 
@@ -439,8 +707,64 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 		ssid = String((char *) ssid_l + 2, WIFI_MIN((int)ssid_l[1], WIFI_NWID_MAXSIZE));
 	}
 
-    StringAccum sa;
-	Vector<int> rates;
+	/* print rates information */
+	if (_debug) {
+		print_probe_request(src, ssid, rates_l, rates_x, htcaps);
+	}
+
+	ResourceElement *el = _el->iface_to_element(iface_id);
+	empower_bands_types supported_band = EMPOWER_BT_L20;
+	if (htcaps && (el->_band == EMPOWER_BT_HT20)) {
+		supported_band = EMPOWER_BT_HT20;
+	}
+
+	struct click_wifi_extra *ceh = WIFI_EXTRA_ANNO(p);
+	int8_t rssi;
+	memcpy(&rssi, &ceh->rssi, 1);
+
+	Timestamp now = Timestamp::now();
+	ProbeKey key(src, ssid, iface_id);
+	ProbeOutcome outcome = PROBE_FORWARDED;
+	empower_probe_policy_actions action;
+
+	// the controller told us how to handle this request, answer right
+	// away and let the controller know with the next report
+	if (lookup_probe_policy(src, ssid, action)) {
+		if (action == EMPOWER_PROBE_DROP) {
+			outcome = PROBE_DROPPED;
+		} else if (send_local_probe_response(src, ssid)) {
+			outcome = PROBE_RESPONDED;
+		}
+	}
+
+	// otherwise ask to the controller because we may want to reject this
+	// request, unless the same request has just been forwarded
+	if (outcome == PROBE_FORWARDED && !forward_probe(key)) {
+		outcome = PROBE_LIMITED;
+	}
+
+	if (outcome != PROBE_FORWARDED) {
+		report_probe(key, supported_band, rssi, outcome, now);
+		p->kill();
+		return;
+	}
+
+	_probes_lock.acquire();
+	_pending_probes.set(src, now);
+	_forwarded++;
+	_probes_lock.release();
+
+	_el->send_probe_request(src, ssid, el->_hwaddr, el->_channel, el->_band, supported_band);
+
+	/* probe processed */
+	p->kill();
+
+}
+
+void EmpowerBeaconSource::print_probe_request(EtherAddress src, String ssid,
+		uint8_t *rates_l, uint8_t *rates_x, uint8_t *htcaps) {
+
+	StringAccum sa;
 	Vector<int> ht_rates;
 
 	sa << "ProbeReq: " << src << " ssid ";
@@ -457,7 +781,6 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 	    int max_len =  WIFI_MIN((int)rates_l[1], WIFI_RATES_MAXSIZE);
 		for (int x = 0; x < max_len; x++) {
 			uint8_t rate = rates_l[x + 2];
-			rates.push_back((int)(rate & WIFI_RATE_VAL));
 			if (rate & WIFI_RATE_BASIC ) {
 				sa << " *" << (int) (rate ^ WIFI_RATE_BASIC);
 			} else {
@@ -472,7 +795,6 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 	    int len = rates_x[1];
 		for (int x = 0; x < len; x++) {
 			uint8_t rate = rates_x[x + 2];
-			rates.push_back((int)(rate & WIFI_RATE_VAL));
 			if (rate & WIFI_RATE_BASIC ) {
 				sa << " *" << (int) (rate ^ WIFI_RATE_BASIC);
 			} else {
@@ -616,28 +938,250 @@ void EmpowerBeaconSource::push(int, Packet *p) {
 		sa << " ]";
 	}
 
-	/* print rates information */
+	click_chatter("%{element} :: %s :: %s",
+			      this,
+			      __func__,
+			      sa.take_string().c_str());
+
+}
+
+/*
+ * Looks for the most specific policy matching a probe request: station
+ * and SSID first, then station only, then SSID only, then any.
+ */
+bool EmpowerBeaconSource::lookup_probe_policy(EtherAddress sta, String ssid,
+		empower_probe_policy_actions &action) {
+
+	EtherAddress any = EtherAddress::make_broadcast();
+	bool found = false;
+
+	_policies_lock.acquire_read();
+
+	if (_policies.size()) {
+		PPIter it = _policies.end();
+		if (ssid != "") {
+			it = _policies.find(ProbePolicyKey(sta, ssid));
+		}
+		if (it == _policies.end()) {
+			it = _policies.find(ProbePolicyKey(sta, ""));
+		}
+		if (it == _policies.end() && ssid != "") {
+			it = _policies.find(ProbePolicyKey(any, ssid));
+		}
+		if (it == _policies.end()) {
+			it = _policies.find(ProbePolicyKey(any, ""));
+		}
+		if (it != _policies.end()) {
+			action = it.value();
+			found = true;
+		}
+	}
+
+	_policies_lock.release_read();
+
+	return found;
+
+}
+
+void EmpowerBeaconSource::set_probe_policy(EtherAddress sta, String ssid,
+		empower_probe_policy_actions action) {
+
 	if (_debug) {
-		click_chatter("%{element} :: %s :: %s",
-				      this,
-				      __func__,
-				      sa.take_string().c_str());
+		click_chatter("%{element} :: %s :: sta %s ssid %s action %u",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  ssid.c_str(),
+					  action);
 	}
 
-	// always ask to the controller because we may want to reject this request
-	ResourceElement *el = _el->iface_to_element(iface_id);
-	if (htcaps && (el->_band == EMPOWER_BT_HT20)) {
-		_el->send_probe_request(src, ssid, el->_hwaddr, el->_channel, el->_band, EMPOWER_BT_HT20);
+	_policies_lock.acquire_write();
+	_policies.set(ProbePolicyKey(sta, ssid), action);
+	_policies_lock.release_write();
+
+}
+
+void EmpowerBeaconSource::del_probe_policy(EtherAddress sta, String ssid) {
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: sta %s ssid %s",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  ssid.c_str());
+	}
+
+	_policies_lock.acquire_write();
+	_policies.erase(ProbePolicyKey(sta, ssid));
+	_policies_lock.release_write();
+
+}
+
+void EmpowerBeaconSource::clear_probe_policies() {
+	_policies_lock.acquire_write();
+	_policies.clear();
+	_policies_lock.release_write();
+}
+
+/*
+ * Token bucket for each station, SSID and interface. Buckets are created
+ * full and removed by the report timer once full again, if there are too
+ * many of them the request is forwarded anyway.
+ */
+bool EmpowerBeaconSource::forward_probe(const ProbeKey &key) {
+
+	if (_probe_rate == 0) {
+		return true;
+	}
+
+	bool forward = true;
+
+	_probes_lock.acquire();
+
+	PLIter it = _limiters.find(key);
+
+	if (it == _limiters.end() && _limiters.size() < MAX_LIMITERS) {
+		it = _limiters.find_insert(key, TokenCounter(true));
+	}
+
+	if (it != _limiters.end()) {
+		it.value().refill(_probe_token_rate);
+		forward = it.value().remove_if(_probe_token_rate, 1);
+	}
+
+	if (!forward) {
+		_limited++;
+	}
+
+	_probes_lock.release();
+
+	return forward;
+
+}
+
+void EmpowerBeaconSource::report_probe(const ProbeKey &key,
+		empower_bands_types supported_band, int rssi, ProbeOutcome outcome,
+		Timestamp start) {
+
+	uint32_t latency = (Timestamp::now() - start).usecval();
+
+	_probes_lock.acquire();
+
+	if (outcome == PROBE_RESPONDED) {
+		_local_latency.add(latency);
+	}
+
+	PRIter it = _reports.find(key);
+
+	if (it == _reports.end()) {
+		if (_reports.size() >= MAX_REPORTS) {
+			_reports_dropped++;
+			_probes_lock.release();
+			return;
+		}
+		ProbeReport report;
+		report._sta = key._sta;
+		report._ssid = key._ssid;
+		report._iface_id = key._iface_id;
+		it = _reports.find_insert(key, report);
+	}
+
+	ProbeReport &report = it.value();
+	report._supported_band = supported_band;
+	report._rssi = rssi;
+
+	if (outcome == PROBE_RESPONDED) {
+		report._responded++;
+	} else if (outcome == PROBE_DROPPED) {
+		report._dropped++;
 	} else {
-		_el->send_probe_request(src, ssid, el->_hwaddr, el->_channel, el->_band, EMPOWER_BT_L20);
+		report._limited++;
 	}
 
-	/* probe processed */
-	p->kill();
+	_probes_lock.release();
+
+}
+
+void EmpowerBeaconSource::flush_reports() {
+
+	Vector<ProbeReport> reports;
+	Timestamp now = Timestamp::now();
+
+	_probes_lock.acquire();
+
+	reports.reserve(_reports.size());
+	for (PRIter it = _reports.begin(); it.live(); it++) {
+		reports.push_back(it.value());
+	}
+	_reports.clear();
+
+	// full buckets are the same as missing ones
+	for (PLIter it = _limiters.begin(); it.live();) {
+		it.value().refill(_probe_token_rate);
+		if (it.value().full()) {
+			it = _limiters.erase(it);
+		} else {
+			it++;
+		}
+	}
+
+	// the controller did not answer, most likely it rejected the station
+	for (PPRIter it = _pending_probes.begin(); it.live();) {
+		if ((now - it.value()).msecval() > PENDING_TIMEOUT) {
+			it = _pending_probes.erase(it);
+		} else {
+			it++;
+		}
+	}
+
+	_probes_lock.release();
+
+	if (reports.size()) {
+		_el->send_probe_report(reports);
+	}
+
+}
+
+int EmpowerBeaconSource::send_local_probe_response(EtherAddress sta, String ssid) {
+
+	EmpowerStationState *ess = _el->get_ess(sta);
+
+	if (ess) {
+		return send_probe_response(ess, ssid);
+	}
+
+	// no LVAP for this station, only the VAPs can answer
+	return send_vap_probe_responses(sta, ssid);
 
 }
 
-void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String ssid) {
+void EmpowerBeaconSource::handle_probe_response(EtherAddress sta, String ssid) {
+
+	EmpowerStationState *ess = _el->get_ess(sta);
+
+	if (!ess) {
+		click_chatter("%{element} :: %s :: unable to find LVAP for station %s",
+					  this,
+					  __func__,
+					  sta.unparse().c_str());
+		return;
+	}
+
+	send_probe_response(ess, ssid);
+
+	_probes_lock.acquire();
+	Timestamp *start = _pending_probes.get_pointer(sta);
+	if (start) {
+		_controller_latency.add((Timestamp::now() - *start).usecval());
+		_pending_probes.erase(sta);
+	}
+	_probes_lock.release();
+
+}
+
+int EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String ssid) {
+
+	int sent = 0;
 
 	if (ssid == "") {
 
@@ -645,13 +1189,7 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 		for (int i = 0; i < ess->_networks.size(); i++) {
 			send_beacon(ess->_sta, ess->_networks[i]._bssid, ess->_networks[i]._ssid,
 					ess->_channel, ess->_iface_id, true, false, 0, 0, 0);
-		}
-
-		// reply also with all vaps
-		for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-			send_beacon(ess->_sta, it.value()._bssid, it.value()._ssid,
-					it.value()._channel, it.value()._iface_id, true, false, 0,
-					0, 0);
+			sent++;
 		}
 
 	} else {
@@ -661,32 +1199,109 @@ void EmpowerBeaconSource::send_probe_response(EmpowerStationState *ess, String s
 			if (ess->_networks[i]._ssid == ssid) {
 				send_beacon(ess->_sta, ess->_networks[i]._bssid, ess->_networks[i]._ssid,
 						ess->_channel, ess->_iface_id, true, false, 0, 0, 0);
+				sent++;
 				break;
 			}
 		}
 
-		// reply also with all vaps
-		for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
-			if (it.value()._ssid == ssid) {
-				send_beacon(ess->_sta, it.value()._bssid, it.value()._ssid,
-						it.value()._channel, it.value()._iface_id, true, false,
-						0, 0, 0);
-			}
-		}
+	}
 
+	// reply also with the vaps
+	return sent + send_vap_probe_responses(ess->_sta, ssid);
+
+}
+
+int EmpowerBeaconSource::send_vap_probe_responses(EtherAddress dst, String ssid) {
+
+	int sent = 0;
+
+	for (VAPIter it = _el->vaps()->begin(); it.live(); it++) {
+		if (ssid == "" || it.value()._ssid == ssid) {
+			send_beacon(dst, it.value()._bssid, it.value()._ssid,
+					it.value()._channel, it.value()._iface_id, true, false,
+					0, 0, 0);
+			sent++;
+		}
 	}
 
+	return sent;
+
 }
 
 enum {
 	H_DEBUG,
+	H_TEMPLATES,
+	H_SLOTS,
+	H_PROBE_POLICIES,
+	H_PROBE_LATENCY,
 };
 
+static void write_latency(StringAccum &sa, const char *name, const ProbeLatency &latency) {
+	sa << name << " count " << latency._count
+	   << " avg " << (latency._count ? latency._sum / latency._count : 0)
+	   << " p50 " << latency.percentile(50)
+	   << " p95 " << latency.percentile(95)
+	   << " p99 " << latency.percentile(99)
+	   << " max " << latency._max << "\n";
+}
+
 String EmpowerBeaconSource::read_handler(Element *e, void *thunk) {
 	EmpowerBeaconSource *td = (EmpowerBeaconSource *) e;
 	switch ((uintptr_t) thunk) {
 	case H_DEBUG:
 		return String(td->_debug) + "\n";
+	case H_SLOTS: {
+		StringAccum sa;
+		for (int i = 0; i < td->_wheel.size(); i++) {
+			sa << "slot " << i << " occupancy " << td->_wheel[i].size() << "\n";
+		}
+		sa << "backlog " << td->_backlog.size() << "\n";
+		sa << "deferred " << td->_deferred << "\n";
+		sa << "overloaded " << td->_overloaded << "\n";
+		return sa.take_string();
+	}
+	case H_PROBE_POLICIES: {
+		StringAccum sa;
+		td->_policies_lock.acquire_read();
+		for (PPIter it = td->_policies.begin(); it.live(); it++) {
+			sa << it.key()._sta.unparse()
+			   << " ssid " << (it.key()._ssid == "" ? "*" : it.key()._ssid)
+			   << (it.value() == EMPOWER_PROBE_DROP ? " drop" : " respond") << "\n";
+		}
+		td->_policies_lock.release_read();
+		return sa.take_string();
+	}
+	case H_PROBE_LATENCY: {
+		StringAccum sa;
+		td->_probes_lock.acquire();
+		write_latency(sa, "local", td->_local_latency);
+		write_latency(sa, "controller", td->_controller_latency);
+		sa << "pending " << td->_pending_probes.size() << "\n";
+		sa << "forwarded " << td->_forwarded << "\n";
+		sa << "limited " << td->_limited << "\n";
+		sa << "limiters " << td->_limiters.size() << "\n";
+		sa << "reports " << td->_reports.size() << "\n";
+		sa << "reports_dropped " << td->_reports_dropped << "\n";
+		td->_probes_lock.release();
+		return sa.take_string();
+	}
+	case H_TEMPLATES: {
+		StringAccum sa;
+		td->_templates_lock.acquire_read();
+		for (BeaconTemplates::iterator it = td->_templates.begin(); it.live(); it++) {
+			for (int i = 0; i < it.value().size(); i++) {
+				BeaconTemplate *tmpl = it.value()[i];
+				sa << it.key().unparse() << " ssid " << tmpl->_ssid
+				   << " channel " << tmpl->_channel
+				   << " iface_id " << tmpl->_iface_id
+				   << (tmpl->_probe ? " probe" : " beacon")
+				   << (tmpl->_csa_active ? " csa" : "")
+				   << " length " << tmpl->_p->length() << "\n";
+			}
+		}
+		td->_templates_lock.release_read();
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -712,6 +1327,10 @@ int EmpowerBeaconSource::write_handler(const String &in_s, Element *e,
 
 void EmpowerBeaconSource::add_handlers() {
 	add_read_handler("debug", read_handler, (void *) H_DEBUG);
+	add_read_handler("templates", read_handler, (void *) H_TEMPLATES);
+	add_read_handler("slots", read_handler, (void *) H_SLOTS);
+	add_read_handler("probe_policies", read_handler, (void *) H_PROBE_POLICIES);
+	add_read_handler("probe_latency", read_handler, (void *) H_PROBE_LATENCY);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
 }
 
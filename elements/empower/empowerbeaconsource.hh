@@ -4,8 +4,13 @@
 #include <click/element.hh>
 #include <click/config.h>
 #include <click/timer.hh>
+#include <click/hashtable.hh>
+#include <click/deque.hh>
+#include <click/sync.hh>
+#include <click/tokenbucket.hh>
 #include <elements/wifi/availablerates.hh>
 #include "empowerlvapmanager.hh"
+#include "empowerqueueinfobase.hh"
 CLICK_DECLS
 
 /*
@@ -24,6 +29,21 @@ Point (WTP). Subsequent probe request are directly handled by the WTP.
 
 =d
 
+The controller can install probe policies for a station, or for any
+station, and for an SSID, or for any SSID. Probe requests matching a
+policy are answered (or dropped) by the WTP without waiting for the
+controller, which is informed by a periodic batched report. Probe
+requests matching no policy are forwarded to the controller, at most
+PROBE_RATE per second for each station, SSID and interface: stations
+send the same probe request several times while scanning, the copies
+in excess are only counted in the next report.
+
+Beacons and probe responses are built once for each BSSID, SSID,
+channel and interface and kept as templates. Sending a frame only
+copies the template and patches the destination address and the
+CSA count. Templates for a BSSID are dropped by the EL element when
+the corresponding LVAP, VAP or transmission policy changes.
+
 Keyword arguments are:
 
 =over 8
@@ -40,14 +60,185 @@ The wireless channel it is operating on.
 =item PERIOD
 How often beacon packets are sent, in milliseconds.
 
+=item SLOTS
+Number of slots the beacon interval is divided into, default is 10.
+Beacons are spread evenly across the slots instead of being sent in
+a single burst.
+
+=item BURST
+Number of beacons sent in a slot, default is 16. Beacons in excess
+are deferred to the following slots. If the beacons left in the
+interval do not fit in the remaining slots, more beacons are sent
+per slot, so every target still gets one beacon per interval.
+
+=item REPORT_PERIOD
+How often probe requests not forwarded to the controller are reported,
+in milliseconds. Default is 100.
+
+=item PROBE_RATE
+Probe requests forwarded to the controller per second for each
+station, SSID and interface, default is 10. Zero disables the limit.
+
+=item PROBE_BURST
+Probe requests forwarded to the controller in a burst for each
+station, SSID and interface, default is 1.
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+=h templates read-only
+Beacon and probe response templates currently cached.
+
+=h slots read-only
+Number of beacons assigned to each slot, plus the number of deferred
+beacons and of slots that exceeded BURST.
+
+=h probe_policies read-only
+Probe policies installed by the controller.
+
+=h probe_latency read-only
+Probe response latency in usec (count, average, 50th, 95th and 99th
+percentile, maximum), separately for probe requests answered locally
+and for probe requests answered by the controller, plus the number of
+probe requests forwarded to the controller and held back by the rate
+limit.
+
 =a EmpowerLVAPManager
 */
 
+// A prebuilt beacon or probe response frame
+class BeaconTemplate {
+public:
+	String _ssid;
+	int _channel;
+	int _iface_id;
+	bool _probe;
+	bool _csa_active;
+	int _csa_mode;
+	int _csa_channel;
+	int _csa_count_offset;
+	Packet *_p;
+	BeaconTemplate() :
+			_channel(0), _iface_id(0), _probe(false), _csa_active(false),
+			_csa_mode(0), _csa_channel(0), _csa_count_offset(-1), _p(0) {
+	}
+	~BeaconTemplate() {
+		if (_p) {
+			_p->kill();
+		}
+	}
+};
+
+typedef HashTable<EtherAddress, Vector<BeaconTemplate *> > BeaconTemplates;
+
+// A beacon to be sent every period: the destination is the station for
+// LVAPs and the broadcast address for VAPs
+class BeaconTarget {
+public:
+	EtherAddress _dst;
+	EtherAddress _bssid;
+	BeaconTarget() {
+	}
+	BeaconTarget(EtherAddress dst, EtherAddress bssid) :
+			_dst(dst), _bssid(bssid) {
+	}
+	inline hashcode_t hashcode() const {
+		return CLICK_NAME(hashcode)(_dst) + CLICK_NAME(hashcode)(_bssid);
+	}
+	inline bool operator==(const BeaconTarget &other) const {
+		return _dst == other._dst && _bssid == other._bssid;
+	}
+};
+
+typedef HashTable<BeaconTarget, int> BeaconSlots;
+typedef BeaconSlots::iterator BSIter;
+
+// A probe policy applies to a station, or to any station if the address
+// is the broadcast one, and to an SSID, or to any SSID if it is empty
+class ProbePolicyKey {
+public:
+	EtherAddress _sta;
+	String _ssid;
+	ProbePolicyKey() {
+	}
+	ProbePolicyKey(EtherAddress sta, String ssid) :
+			_sta(sta), _ssid(ssid) {
+	}
+	inline hashcode_t hashcode() const {
+		return CLICK_NAME(hashcode)(_sta) + _ssid.hashcode();
+	}
+	inline bool operator==(const ProbePolicyKey &other) const {
+		return _sta == other._sta && _ssid == other._ssid;
+	}
+};
+
+typedef HashTable<ProbePolicyKey, empower_probe_policy_actions> ProbePolicies;
+typedef ProbePolicies::iterator PPIter;
+
+// Probe requests are rate limited and reported per station, SSID and
+// interface
+class ProbeKey {
+public:
+	EtherAddress _sta;
+	String _ssid;
+	int _iface_id;
+	ProbeKey() :
+			_iface_id(0) {
+	}
+	ProbeKey(EtherAddress sta, String ssid, int iface_id) :
+			_sta(sta), _ssid(ssid), _iface_id(iface_id) {
+	}
+	inline hashcode_t hashcode() const {
+		return CLICK_NAME(hashcode)(_sta) + _ssid.hashcode() + _iface_id;
+	}
+	inline bool operator==(const ProbeKey &other) const {
+		return _sta == other._sta && _iface_id == other._iface_id && _ssid == other._ssid;
+	}
+};
+
+typedef HashTable<ProbeKey, ProbeReport> ProbeReports;
+typedef ProbeReports::iterator PRIter;
+
+typedef HashTable<ProbeKey, TokenCounter> ProbeLimiters;
+typedef ProbeLimiters::iterator PLIter;
+
+typedef HashTable<EtherAddress, Timestamp> PendingProbes;
+typedef PendingProbes::iterator PPRIter;
+
+// Probe response latency in usec, from the reception of the probe
+// request to the transmission of the probe response. Same log-scale
+// buckets as the queue delay statistics.
+class ProbeLatency {
+public:
+	uint32_t _count;
+	uint64_t _sum;
+	uint32_t _max;
+	uint32_t _histogram[QueueDelayStats::NB_BUCKETS];
+	ProbeLatency() :
+			_count(0), _sum(0), _max(0) {
+		memset(_histogram, 0, sizeof(_histogram));
+	}
+	void add(uint32_t usec) {
+		_count++;
+		_sum += usec;
+		_max = usec > _max ? usec : _max;
+		_histogram[QueueDelayStats::bucket(usec)]++;
+	}
+	uint32_t percentile(uint32_t pct) const {
+		uint32_t rank = ((uint64_t) _count * pct + 99) / 100;
+		uint32_t seen = 0;
+		for (uint32_t i = 0; i < QueueDelayStats::NB_BUCKETS; i++) {
+			seen += _histogram[i];
+			if (seen >= rank) {
+				return QueueDelayStats::bucket_value(i);
+			}
+		}
+		return 0;
+	}
+};
+
 class EmpowerBeaconSource: public Element {
 public:
 
@@ -66,7 +257,15 @@ public:
 	void send_beacon(EtherAddress, EtherAddress, String, int, int, bool, bool, int, int, int);
 	void send_lvap_csa_beacon(EmpowerStationState *);
 
-	void send_probe_response(EmpowerStationState *, String);
+	int send_probe_response(EmpowerStationState *, String);
+	void handle_probe_response(EtherAddress, String);
+
+	void set_probe_policy(EtherAddress, String, empower_probe_policy_actions);
+	void del_probe_policy(EtherAddress, String);
+	void clear_probe_policies();
+
+	void invalidate_templates(EtherAddress);
+	void clear_templates();
 
 	void push(int, Packet *);
 
@@ -74,9 +273,63 @@ private:
 
 	class EmpowerLVAPManager *_el;
 
+	ReadWriteLock _templates_lock;
+	BeaconTemplates _templates;
+
+	BeaconTemplate *lookup_template(EtherAddress, String, int, int, bool, bool, int, int);
+	BeaconTemplate *build_template(EtherAddress, String, int, int, bool, bool, int, int);
+
 	unsigned int _period; // msecs
 	Timer _timer;
 
+	// beacon wheel
+	unsigned int _slots;
+	unsigned int _burst;
+	unsigned int _crr_slot;
+	BeaconSlots _slot_table;
+	Vector<Vector<BeaconTarget> > _wheel;
+	Deque<BeaconTarget> _backlog;
+	uint32_t _unqueued; // targets of the following slots
+	uint32_t _deferred;
+	uint32_t _overloaded;
+
+	void update_wheel();
+	void send_target(const BeaconTarget &);
+
+	// probe policies, installed by the controller
+	ReadWriteLock _policies_lock;
+	ProbePolicies _policies;
+
+	bool lookup_probe_policy(EtherAddress, String, empower_probe_policy_actions &);
+	int send_vap_probe_responses(EtherAddress, String);
+	int send_local_probe_response(EtherAddress, String);
+
+	// probe requests waiting for the controller, rate limits toward
+	// the controller, and probe requests not yet reported
+	enum { MAX_REPORTS = 1024, MAX_LIMITERS = 4096, PENDING_TIMEOUT = 1000 };
+	enum ProbeOutcome { PROBE_FORWARDED, PROBE_RESPONDED, PROBE_DROPPED, PROBE_LIMITED };
+	SimpleSpinlock _probes_lock;
+	PendingProbes _pending_probes;
+	ProbeLimiters _limiters;
+	ProbeReports _reports;
+	uint32_t _reports_dropped;
+	uint32_t _forwarded;
+	uint32_t _limited;
+	ProbeLatency _local_latency;
+	ProbeLatency _controller_latency;
+
+	unsigned int _probe_rate; // probes per second
+	unsigned int _probe_burst;
+	TokenRate _probe_token_rate;
+
+	unsigned int _report_period; // msecs
+	Timer _report_timer;
+
+	bool forward_probe(const ProbeKey &);
+	void report_probe(const ProbeKey &, empower_bands_types, int, ProbeOutcome, Timestamp);
+	void flush_reports();
+	void print_probe_request(EtherAddress, String, uint8_t *, uint8_t *, uint8_t *);
+
 	bool _debug;
 
 	// Read/Write handlers
@@ -157,6 +157,10 @@ void EmpowerDeAuthResponder::push(int, Packet *p) {
 	ess->_ssid = "";
 	ess->_bssid = EtherAddress();
 
+	_el->lock()->acquire_write();
+	_el->update_station_index();
+	_el->lock()->release_write();
+
 	_el->send_status_lvap(src);
 
 	p->kill();
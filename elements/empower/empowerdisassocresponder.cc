@@ -144,6 +144,10 @@ void EmpowerDisassocResponder::push(int, Packet *p) {
 	ess->_association_status = false;
 	ess->_ssid = "";
 
+	_el->lock()->acquire_write();
+	_el->update_station_index();
+	_el->lock()->release_write();
+
 	_el->send_status_lvap(src);
 
 	p->kill();
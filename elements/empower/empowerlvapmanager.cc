@@ -15,6 +15,8 @@
  */
 
 #include <click/config.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "empowerlvapmanager.hh"
 #include <click/straccum.hh>
 #include <click/args.hh>
@@ -38,22 +40,69 @@ CLICK_DECLS
 
 EmpowerLVAPManager::EmpowerLVAPManager() :
 		_e11k(0), _ebs(0), _eauthr(0), _eassor(0), _edeauthr(0), _ers(0),
-		_mtbl(0), _timer(this), _seq(0), _period(5000), _debug(false) {
+		_mtbl(0), _station_index(new StationIndex()), _timer(this),
+		_flush_timer(this), _mask_timer(this), _seq(0), _period(5000), _debug(false),
+		_rx_partial(0), _rx_desync(false), _rx_discarded(0),
+		_tx_pending_bytes(0), _flush_latency(0), _max_batch(65536), _rx_messages(0), _rx_reassembled(0),
+		_tx_messages(0), _tx_batches(0) {
 }
 
 EmpowerLVAPManager::~EmpowerLVAPManager() {
+	for (int i = 0; i < _retired_indexes.size(); i++) {
+		delete _retired_indexes[i];
+	}
+	for (int i = 0; i < _expired_indexes.size(); i++) {
+		delete _expired_indexes[i];
+	}
+	delete _station_index;
+	reset_channel();
+	for (int i = 0; i < _debugfs_fds.size(); i++) {
+		if (_debugfs_fds[i] >= 0) {
+			close(_debugfs_fds[i]);
+		}
+	}
 }
 
 int EmpowerLVAPManager::initialize(ErrorHandler *) {
 	_timer.initialize(this);
 	_timer.schedule_now();
-	compute_bssid_mask();
+	_flush_timer.initialize(this);
+	_mask_timer.initialize(this);
+	for (int i = 0; i < _masks.size(); i++) {
+		BssidMask mask;
+		if (ResourceElement *elm = _ifaces_to_elements.get(i)) {
+			mask._hwaddr = elm->_hwaddr;
+		}
+		_bssid_masks.push_back(mask);
+		_debugfs_fds.push_back(-1);
+	}
+	write_bssid_masks(true);
 	return 0;
 }
 
-void EmpowerLVAPManager::run_timer(Timer *) {
-	// send hello packet
-	send_hello();
+void EmpowerLVAPManager::run_timer(Timer *timer) {
+	if (timer == &_flush_timer) {
+		flush_messages();
+		return;
+	}
+	if (timer == &_mask_timer) {
+		write_bssid_masks(false);
+		return;
+	}
+	// send hello packet, unless the inbound stream is out of sync and
+	// the controller must drop this agent so that it reconnects
+	if (!_rx_desync) {
+		send_hello();
+	}
+	// free the station indexes retired before the previous tick, by now
+	// no data path reader can still be holding a pointer into them
+	_lock.acquire_write();
+	for (int i = 0; i < _expired_indexes.size(); i++) {
+		delete _expired_indexes[i];
+	}
+	_expired_indexes.swap(_retired_indexes);
+	_retired_indexes.clear();
+	_lock.release_write();
 	// re-schedule the timer with some jitter
 	unsigned max_jitter = _period / 10;
 	unsigned j = click_random(0, 2 * max_jitter);
@@ -97,6 +146,8 @@ int EmpowerLVAPManager::configure(Vector<String> &conf,
 			                    .read_m("ERS", ElementCastArg("EmpowerRXStats"), _ers)
 								.read("MTBL", ElementCastArg("EmpowerMulticastTable"), _mtbl)
 								.read("PERIOD", _period)
+								.read("FLUSH_LATENCY", _flush_latency)
+								.read("MAX_BATCH", _max_batch)
 			                    .read("DEBUG", _debug)
 			                    .complete();
 
@@ -310,6 +361,55 @@ void EmpowerLVAPManager::send_probe_request(EtherAddress src, String ssid, Ether
 
 }
 
+void EmpowerLVAPManager::send_probe_report(const Vector<ProbeReport> &reports) {
+
+	int nb_entries = reports.size();
+
+	int len = sizeof(empower_probe_report);
+	len += nb_entries * sizeof(struct probe_report_entry);
+
+	WritablePacket *p = Packet::make(len);
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+					  this,
+					  __func__);
+		return;
+	}
+
+	memset(p->data(), 0, p->length());
+
+	empower_probe_report *report = (struct empower_probe_report *) (p->data());
+	report->set_version(_empower_version);
+	report->set_length(len);
+	report->set_type(EMPOWER_PT_PROBE_REPORT);
+	report->set_seq(get_next_seq());
+	report->set_wtp(_wtp);
+	report->set_nb_entries(nb_entries);
+
+	uint8_t *ptr = (uint8_t *) report;
+	ptr += sizeof(struct empower_probe_report);
+
+	for (int i = 0; i < nb_entries; i++) {
+		ResourceElement *el = iface_to_element(reports[i]._iface_id);
+		probe_report_entry *entry = (probe_report_entry *) ptr;
+		entry->set_sta(reports[i]._sta);
+		entry->set_hwaddr(el->_hwaddr);
+		entry->set_channel(el->_channel);
+		entry->set_band(el->_band);
+		entry->set_supported_band(reports[i]._supported_band);
+		entry->set_rssi(reports[i]._rssi);
+		entry->set_nb_responded(reports[i]._responded);
+		entry->set_nb_dropped(reports[i]._dropped);
+		entry->set_nb_limited(reports[i]._limited);
+		entry->set_ssid(reports[i]._ssid);
+		ptr += sizeof(struct probe_report_entry);
+	}
+
+	send_message(p);
+
+}
+
 void EmpowerLVAPManager::send_message(Packet *p) {
 	if (_ports.size() == 0) {
 		if (_debug) {
@@ -318,7 +418,97 @@ void EmpowerLVAPManager::send_message(Packet *p) {
 		p->kill();
 		return;
 	}
+	_tx_lock.acquire();
+	_tx_pending.push_back(p);
+	_tx_pending_bytes += p->length();
+	bool first = _tx_pending.size() == 1;
+	bool full = _tx_pending_bytes >= _max_batch;
+	_tx_lock.release();
+	if (full) {
+		flush_messages();
+	} else if (first) {
+		if (_flush_latency) {
+			_flush_timer.schedule_after(Timestamp::make_usec(_flush_latency));
+		} else {
+			_flush_timer.schedule_now();
+		}
+	}
+}
+
+/*
+ * Sends the pending messages to the Access Controller as a single packet,
+ * i.e. a single write on the control socket.
+ */
+void EmpowerLVAPManager::flush_messages() {
+
+	Vector<Packet *> batch;
+
+	// keep batches in order when two threads flush at the same time
+	_flush_lock.acquire();
+
+	_tx_lock.acquire();
+	batch.swap(_tx_pending);
+	uint32_t len = _tx_pending_bytes;
+	_tx_pending_bytes = 0;
+	_tx_lock.release();
+
+	if (batch.size() == 0) {
+		_flush_lock.release();
+		return;
+	}
+
+	_tx_messages += batch.size();
+	_tx_batches++;
+
+	if (batch.size() == 1) {
+		output(0).push(batch[0]);
+		_flush_lock.release();
+		return;
+	}
+
+	WritablePacket *p = Packet::make(len);
+
+	if (!p) {
+		click_chatter("%{element} :: %s :: cannot make packet!",
+				      this,
+				      __func__);
+		for (int i = 0; i < batch.size(); i++) {
+			batch[i]->kill();
+		}
+		_flush_lock.release();
+		return;
+	}
+
+	uint8_t *ptr = p->data();
+
+	for (int i = 0; i < batch.size(); i++) {
+		memcpy(ptr, batch[i]->data(), batch[i]->length());
+		ptr += batch[i]->length();
+		batch[i]->kill();
+	}
+
 	output(0).push(p);
+
+	_flush_lock.release();
+
+}
+
+/*
+ * Drops the state of the control channel, must be called when the
+ * connection with the Access Controller is reset.
+ */
+void EmpowerLVAPManager::reset_channel() {
+	if (_rx_partial) {
+		_rx_partial->kill();
+		_rx_partial = 0;
+	}
+	_tx_lock.acquire();
+	for (int i = 0; i < _tx_pending.size(); i++) {
+		_tx_pending[i]->kill();
+	}
+	_tx_pending.clear();
+	_tx_pending_bytes = 0;
+	_tx_lock.release();
 }
 
 void EmpowerLVAPManager::send_hello() {
@@ -384,6 +574,10 @@ void EmpowerLVAPManager::send_status_slice(String ssid, int dscp, int iface_id)
 		status->set_flags(EMPOWER_AMSDU_AGGREGATION);
 	}
 
+	if (queue->_codel._enabled) {
+		status->set_flags(queue->_codel._fq ? EMPOWER_AQM_FQ_CODEL : EMPOWER_AQM_CODEL);
+	}
+
 	send_message(p);
 }
 
@@ -440,13 +634,17 @@ void EmpowerLVAPManager::send_slice_queue_counters_response(uint32_t counters_id
     }
 
 	Slice slice = Slice(ssid, dscp);
+
+	_eqms[iface_id]->lock()->acquire_read();
+
 	SliceQueue * queue = _eqms[iface_id]->slices()->get(slice);
 
 	if (!queue) {
+		_eqms[iface_id]->lock()->release_read();
 		return;
 	}
 
-    int len = sizeof(empower_slice_queue_counters_response);
+    int len = sizeof(empower_slice_queue_counters_response) + queue->_queues.size() * sizeof(slice_station_entry);
 
     WritablePacket *p = Packet::make(len);
 
@@ -454,6 +652,7 @@ void EmpowerLVAPManager::send_slice_queue_counters_response(uint32_t counters_id
         click_chatter("%{element} :: %s :: cannot make packet!",
                       this,
                       __func__);
+        _eqms[iface_id]->lock()->release_read();
         return;
     }
 
@@ -475,6 +674,30 @@ void EmpowerLVAPManager::send_slice_queue_counters_response(uint32_t counters_id
     counters->set_queue_delay_usec(queue->_queue_delay_usec);
     counters->set_deficit_avg(queue->_deficit_avg);
     counters->set_deficit(queue->_deficit);
+    counters->set_queue_delay_ewma(queue->_queue_delay_ewma);
+    counters->set_queue_delay_p50(queue->_queue_delay_p50);
+    counters->set_queue_delay_p95(queue->_queue_delay_p95);
+    counters->set_queue_delay_p99(queue->_queue_delay_p99);
+    counters->set_nb_stations(queue->_queues.size());
+
+    uint8_t *ptr = (uint8_t *) counters;
+    ptr += sizeof(struct empower_slice_queue_counters_response);
+
+    for (AQIter it = queue->_queues.begin(); it.live(); it++) {
+        AggregationQueue *aq = it.value();
+        slice_station_entry *entry = (slice_station_entry *) ptr;
+        entry->set_sta(aq->pair()._ra);
+        entry->set_tx_airtime(aq->_tx_airtime);
+        entry->set_tx_packets(aq->_tx_packets);
+        entry->set_tx_bytes(aq->_tx_bytes);
+        entry->set_deficit(aq->_deficit);
+        entry->set_sojourn(aq->_sojourn);
+        entry->set_drops(aq->drops());
+        entry->set_aqm_drops(aq->_aqm_drops);
+        ptr += sizeof(struct slice_station_entry);
+    }
+
+    _eqms[iface_id]->lock()->release_read();
 
     send_message(p);
 
@@ -715,7 +938,7 @@ void EmpowerLVAPManager::send_img_response(int type, uint32_t graph_id,
 		entry->set_last_rssi_std(neighbors[i]._last_std);
 		entry->set_last_packets(neighbors[i]._last_packets);
 		entry->set_hist_packets(neighbors[i]._hist_packets);
-		entry->set_mov_rssi(neighbors[i]._sma_rssi->avg());
+		entry->set_mov_rssi(neighbors[i]._sma_rssi.avg());
 		ptr += sizeof(struct cqm_entry);
 	}
 
@@ -723,7 +946,7 @@ void EmpowerLVAPManager::send_img_response(int type, uint32_t graph_id,
 
 }
 
-void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherAddress hwaddr, uint8_t channel, empower_bands_types band) {
+void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherAddress hwaddr, uint8_t channel, empower_bands_types band, bool range, uint32_t window, uint32_t resolution) {
 
 	int iface_id = element_to_iface(hwaddr, channel, band);
 
@@ -737,7 +960,33 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherA
 		return;
 	}
 
-	int len = sizeof(empower_wifi_stats_response) + sizeof(wifi_stats_entry) * _regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size * 3;
+	EmpowerRegmon *regmon = _regmons[iface_id];
+	empower_regmon_types types[] = { EMPOWER_REGMON_TX, EMPOWER_REGMON_RX, EMPOWER_REGMON_ED };
+	int tier = range ? regmon->tier(resolution) : 0;
+
+	// select the samples in the requested window of each register
+	int first[3];
+	int nb_entries = 0;
+
+	for (int r = 0; r < 3; r++) {
+		const RegmonTier *samples = regmon->registers(types[r])->tier(tier);
+		first[r] = 0;
+		if (window && samples->count()) {
+			uint64_t newest = samples->at(samples->count() - 1)._timestamp;
+			uint64_t span = (uint64_t) window * 1000;
+			if (newest > span) {
+				first[r] = samples->lower_bound(newest - span);
+			}
+		}
+		// nb_entries is 16 bits wide, keep the newest samples
+		if (samples->count() - first[r] > 0xffff / 3) {
+			first[r] = samples->count() - 0xffff / 3;
+		}
+		nb_entries += samples->count() - first[r];
+	}
+
+	int entry_len = range ? sizeof(wifi_stats_range_entry) : sizeof(wifi_stats_entry);
+	int len = sizeof(empower_wifi_stats_response) + entry_len * nb_entries;
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
@@ -756,38 +1005,28 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherA
 	stats->set_seq(get_next_seq());
 	stats->set_wifi_stats_id(wifi_stats_id);
 	stats->set_wtp(_wtp);
-	stats->set_nb_entries(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size * 3);
+	stats->set_nb_entries(nb_entries);
 
 	uint8_t *ptr = (uint8_t *) stats;
 	ptr += sizeof(struct empower_wifi_stats_response);
 
 	uint8_t *end = ptr + (len - sizeof(struct empower_wifi_stats_response));
 
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_size; i++) {
-		assert (ptr <= end);
-		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_TX)->_samples[i]);
-		ptr += sizeof(struct wifi_stats_entry);
-	}
-
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_size; i++) {
-		assert (ptr <= end);
-		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_RX)->_samples[i]);
-		ptr += sizeof(struct wifi_stats_entry);
-	}
-
-	for (int i = 0; i < _regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_size; i++) {
-		assert (ptr <= end);
-		wifi_stats_entry *entry = (wifi_stats_entry *) ptr;
-		entry->set_type(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_type);
-		entry->set_timestamp(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_timestamps[i]);
-		entry->set_sample(_regmons[iface_id]->registers(EMPOWER_REGMON_ED)->_samples[i]);
-		ptr += sizeof(struct wifi_stats_entry);
+	for (int r = 0; r < 3; r++) {
+		const RegmonTier *samples = regmon->registers(types[r])->tier(tier);
+		for (int i = first[r]; i < samples->count(); i++) {
+			assert (ptr < end);
+			const RegmonSample &sample = samples->at(i);
+			wifi_stats_range_entry *entry = (wifi_stats_range_entry *) ptr;
+			entry->set_type(types[r]);
+			entry->set_timestamp(sample._timestamp);
+			entry->set_sample(sample._avg);
+			if (range) {
+				entry->set_min(sample._min);
+				entry->set_max(sample._max);
+			}
+			ptr += entry_len;
+		}
 	}
 
 	send_message(p);
@@ -796,7 +1035,7 @@ void EmpowerLVAPManager::send_wifi_stats_response(uint32_t wifi_stats_id, EtherA
 
 void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 
-	int len = sizeof(empower_summary_trigger) + summary->_frames.size() * sizeof(summary_entry);
+	int len = sizeof(empower_summary_trigger) + summary->_nb_entries * sizeof(summary_entry);
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
@@ -806,7 +1045,7 @@ void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 		return;
 	}
 
-	memset(p->data(), 0, p->length());
+	memset(p->data(), 0, sizeof(empower_summary_trigger));
 
 	empower_summary_trigger* request = (struct empower_summary_trigger *) (p->data());
 	request->set_version(_empower_version);
@@ -815,29 +1054,14 @@ void EmpowerLVAPManager::send_summary_trigger(SummaryTrigger * summary) {
 	request->set_seq(get_next_seq());
 	request->set_trigger_id(summary->_trigger_id);
 	request->set_wtp(_wtp);
-	request->set_nb_frames(summary->_frames.size());
+	request->set_nb_frames(summary->_nb_entries);
 
-	uint8_t *ptr = (uint8_t *) request;
-	ptr += sizeof(struct empower_summary_trigger);
-	uint8_t *end = ptr + (len - sizeof(struct empower_summary_trigger));
+	// entries are captured in the on-wire format
+	memcpy(p->data() + sizeof(empower_summary_trigger),
+		   summary->_entries,
+		   summary->_nb_entries * sizeof(summary_entry));
 
-	for (int i = 0; i < summary->_frames.size(); i++) {
-		assert (ptr <= end);
-		summary_entry *entry = (summary_entry *) ptr;
-		entry->set_ra(summary->_frames[i]._ra);
-		entry->set_ta(summary->_frames[i]._ta);
-		entry->set_tsft(summary->_frames[i]._tsft);
-		entry->set_flags(summary->_frames[i]._flags);
-		entry->set_seq(summary->_frames[i]._seq);
-		entry->set_rssi(summary->_frames[i]._rssi);
-		entry->set_rate(summary->_frames[i]._rate);
-		entry->set_length(summary->_frames[i]._length);
-		entry->set_type(summary->_frames[i]._type);
-		entry->set_subtype(summary->_frames[i]._subtype);
-		ptr += sizeof(struct summary_entry);
-	}
-
-	summary->_frames.clear();
+	summary->clear();
 
 	send_message(p);
 
@@ -865,7 +1089,7 @@ void EmpowerLVAPManager::send_lvap_stats_response(EtherAddress lvap, uint32_t lv
 		return;
 	}
 
-	int len = sizeof(empower_lvap_stats_response) + nfo->rates.size() * sizeof(lvap_stats_entry);
+	int len = sizeof(empower_lvap_stats_response) + nfo->nb_rates * sizeof(lvap_stats_entry);
 	WritablePacket *p = Packet::make(len);
 
 	if (!p) {
@@ -884,13 +1108,13 @@ void EmpowerLVAPManager::send_lvap_stats_response(EtherAddress lvap, uint32_t lv
 	lvap_stats->set_seq(get_next_seq());
 	lvap_stats->set_lvap_stats_id(lvap_stats_id);
 	lvap_stats->set_wtp(_wtp);
-	lvap_stats->set_nb_entries(nfo->rates.size());
+	lvap_stats->set_nb_entries(nfo->nb_rates);
 
 	uint8_t *ptr = (uint8_t *) lvap_stats;
 	ptr += sizeof(struct empower_lvap_stats_response);
 	uint8_t *end = ptr + (len - sizeof(struct empower_lvap_stats_response));
 
-	for (int i = 0; i < nfo->rates.size(); i++) {
+	for (int i = 0; i < nfo->nb_rates; i++) {
 		assert (ptr <= end);
 		lvap_stats_entry *entry = (lvap_stats_entry *) ptr;
 		entry->set_rate(nfo->rates[i]);
@@ -903,6 +1127,23 @@ void EmpowerLVAPManager::send_lvap_stats_response(EtherAddress lvap, uint32_t lv
 
 }
 
+/* serialize the non-empty buckets of a histogram, each one is reported with
+ * the mean length of its frames, so that size times count gives its bytes */
+static uint8_t *
+write_counters(uint8_t *ptr, uint8_t *end, const FrameHistogram &histogram) {
+	for (int i = 0; i < FrameHistogram::NB_BUCKETS; i++) {
+		if (!histogram._buckets[i]) {
+			continue;
+		}
+		assert (ptr < end);
+		counters_entry *entry = (counters_entry *) ptr;
+		entry->set_size(histogram.mean_length(i));
+		entry->set_count(histogram._buckets[i]);
+		ptr += sizeof(struct counters_entry);
+	}
+	return ptr;
+}
+
 void EmpowerLVAPManager::send_counters_response(EtherAddress sta, uint32_t counters_id) {
 
 	TxPolicyInfo * txp = get_txp(sta);
@@ -915,9 +1156,12 @@ void EmpowerLVAPManager::send_counters_response(EtherAddress sta, uint32_t count
 		return;
 	}
 
+	int nb_tx = txp->_tx.nb_used();
+	int nb_rx = txp->_rx.nb_used();
+
 	int len = sizeof(empower_counters_response);
-	len += txp->_tx.size() * 6; // the tx samples
-	len += txp->_rx.size() * 6; // the rx samples
+	len += nb_tx * sizeof(struct counters_entry); // the tx buckets
+	len += nb_rx * sizeof(struct counters_entry); // the rx buckets
 
 	WritablePacket *p = Packet::make(len);
 
@@ -938,29 +1182,16 @@ void EmpowerLVAPManager::send_counters_response(EtherAddress sta, uint32_t count
 	counters->set_counters_id(counters_id);
 	counters->set_wtp(_wtp);
 	counters->set_sta(sta);
-	counters->set_nb_tx(txp->_tx.size());
-	counters->set_nb_rx(txp->_rx.size());
+	counters->set_nb_tx(nb_tx);
+	counters->set_nb_rx(nb_rx);
 
 	uint8_t *ptr = (uint8_t *) counters;
 	ptr += sizeof(struct empower_counters_response);
 
 	uint8_t *end = ptr + (len - sizeof(struct empower_counters_response));
 
-	for (CBytesIter iter = txp->_tx.begin(); iter.live(); iter++) {
-		assert (ptr <= end);
-		counters_entry *entry = (counters_entry *) ptr;
-		entry->set_size(iter.key());
-		entry->set_count(iter.value());
-		ptr += sizeof(struct counters_entry);
-	}
-
-	for (CBytesIter iter = txp->_rx.begin(); iter.live(); iter++) {
-		assert (ptr <= end);
-		counters_entry *entry = (counters_entry *) ptr;
-		entry->set_size(iter.key());
-		entry->set_count(iter.value());
-		ptr += sizeof(struct counters_entry);
-	}
+	ptr = write_counters(ptr, end, txp->_tx);
+	ptr = write_counters(ptr, end, txp->_rx);
 
 	send_message(p);
 
@@ -1071,8 +1302,10 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t counters_id, EtherA
 		return;
 	}
 
+	int nb_tx = tx_policy->_tx.nb_used();
+
 	int len = sizeof(empower_txp_counters_response);
-	len += tx_policy->_tx.size() * 6; // the tx samples
+	len += nb_tx * sizeof(struct counters_entry); // the tx buckets
 
 	WritablePacket *p = Packet::make(len);
 
@@ -1092,20 +1325,14 @@ void EmpowerLVAPManager::send_txp_counters_response(uint32_t counters_id, EtherA
 	counters->set_seq(get_next_seq());
 	counters->set_counters_id(counters_id);
 	counters->set_wtp(_wtp);
-	counters->set_nb_tx(tx_policy->_tx.size());
+	counters->set_nb_tx(nb_tx);
 
 	uint8_t *ptr = (uint8_t *) counters;
 	ptr += sizeof(struct empower_txp_counters_response);
 
 	uint8_t *end = ptr + (len - sizeof(struct empower_txp_counters_response));
 
-	for (CBytesIter iter = tx_policy->_tx.begin(); iter.live(); iter++) {
-		assert (ptr <= end);
-		counters_entry *entry = (counters_entry *) ptr;
-		entry->set_size(iter.key());
-		entry->set_count(iter.value());
-		ptr += sizeof(struct counters_entry);
-	}
+	ptr = write_counters(ptr, end, tx_policy->_tx);
 
 	send_message(p);
 
@@ -1221,13 +1448,16 @@ int EmpowerLVAPManager::handle_add_vap(Packet *p, uint32_t offset) {
 		state._iface_id = iface;
 		_vaps.set(bssid, state);
 
-		/* Regenerate the BSSID mask */
-		compute_bssid_mask();
+		/* Drop stale beacons for this BSSID */
+		_ebs->invalidate_templates(bssid);
+
+		/* Add this VAP's BSSID to the mask */
+		update_bssid_mask(iface, bssid, 1);
 
 		/* create default slice */
 		if (ssid != "") {
 			// TODO: for the moment assume that at worst a 1500 bytes frame can be sent in 12000 usec
-			_eqms[iface]->set_slice(ssid, 0, 12000, false, 0);
+			_eqms[iface]->set_slice(ssid, 0, 12000, false, 0, 0);
 		}
 
 		return 0;
@@ -1253,10 +1483,13 @@ int EmpowerLVAPManager::handle_del_vap(Packet *p, uint32_t offset) {
 		return -1;
 	}
 
+	// Remove this VAP's BSSID from the mask
+	update_bssid_mask(_vaps.get_pointer(bssid)->_iface_id, bssid, -1);
+
 	_vaps.erase(_vaps.find(bssid));
 
-	// Remove this VAP's BSSID from the mask
-	compute_bssid_mask();
+	// Drop cached beacons
+	_ebs->invalidate_templates(bssid);
 
 	return 0;
 
@@ -1331,6 +1564,7 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 		state._channel = channel;
 		state._band = band;
 		state._supported_band = supported_band;
+		state._max_amsdu_length = 3839;
 		state._set_mask = set_mask;
 		state._authentication_status = authentication_state;
 		state._association_status = association_state;
@@ -1348,8 +1582,14 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 
 		_lvaps.set(sta, state);
 
-		/* Regenerate the BSSID mask */
-		compute_bssid_mask();
+		/* Drop stale beacons for these networks */
+		invalidate_beacons(&state);
+
+		/* Publish new station index */
+		update_station_index();
+
+		/* Add this LVAP's BSSIDs to the mask */
+		update_bssid_mask(&state, 1);
 
 		/* send add lvap response message */
 		send_add_del_lvap_response(EMPOWER_PT_ADD_LVAP_RESPONSE, state._sta, module_id, 0);
@@ -1368,6 +1608,10 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 
 	EmpowerStationState *ess = _lvaps.get_pointer(sta);
 
+	/* Drop beacons and mask bits for the old networks */
+	invalidate_beacons(ess);
+	update_bssid_mask(ess, -1);
+
 	ess->_bssid = bssid;
 	ess->_ssid = ssid;
 	ess->_networks = networks;
@@ -1377,6 +1621,13 @@ int EmpowerLVAPManager::handle_add_lvap(Packet *p, uint32_t offset) {
 	ess->_supported_band = supported_band;
 	ess->_set_mask = set_mask;
 
+	/* Drop beacons and set mask bits for the new networks */
+	invalidate_beacons(ess);
+	update_bssid_mask(ess, 1);
+
+	/* Publish new station index */
+	update_station_index();
+
 	/* send add lvap response message */
 	send_add_del_lvap_response(EMPOWER_PT_ADD_LVAP_RESPONSE, ess->_sta, module_id, 0);
 
@@ -1473,11 +1724,21 @@ int EmpowerLVAPManager::handle_set_port(Packet *p, uint32_t offset) {
 
 	MinstrelDstInfo *nfo = _rcs.at(iface)->neighbors()->findp(addr);
 
-	if (!nfo || !nfo->rates.size()) {
+	if (!nfo || !nfo->nb_rates) {
 		TxPolicyInfo * txp = _rcs[iface]->tx_policies()->tx_table()->find(addr);
 		nfo = _rcs.at(iface)->insert_neighbor(addr, txp);
 	}
 
+	/* Beacon rates may have changed */
+	_ebs->invalidate_templates(addr);
+
+	/* Tx policy may have been created, refresh the station index */
+	if (_lvaps.get_pointer(addr)) {
+		_lock.acquire_write();
+		update_station_index();
+		_lock.release_write();
+	}
+
 	send_status_port(addr, iface);
 
 	return 0;
@@ -1508,6 +1769,16 @@ int EmpowerLVAPManager::handle_del_port(Packet *p, uint32_t offset) {
 	_rcs[iface]->tx_policies()->remove(addr);
 	_rcs[iface]->forget_station(addr);
 
+	/* Beacon rates may have changed */
+	_ebs->invalidate_templates(addr);
+
+	/* Tx policy has been removed, refresh the station index */
+	if (_lvaps.get_pointer(addr)) {
+		_lock.acquire_write();
+		update_station_index();
+		_lock.release_write();
+	}
+
 	return 0;
 
 }
@@ -1598,8 +1869,24 @@ int EmpowerLVAPManager::handle_probe_response(Packet *p, uint32_t offset) {
 	struct empower_probe_response *q = (struct empower_probe_response *) (p->data() + offset);
 	EtherAddress sta = q->sta();
 	String ssid = q->ssid();
-	EmpowerStationState *ess = _lvaps.get_pointer(sta);
-	_ebs->send_probe_response(ess, ssid);
+	_ebs->handle_probe_response(sta, ssid);
+	return 0;
+}
+
+int EmpowerLVAPManager::handle_set_probe_policy(Packet *p, uint32_t offset) {
+	struct empower_set_probe_policy *q = (struct empower_set_probe_policy *) (p->data() + offset);
+	EtherAddress sta = q->sta();
+	String ssid = q->ssid();
+	empower_probe_policy_actions action = (empower_probe_policy_actions) q->action();
+	_ebs->set_probe_policy(sta, ssid, action);
+	return 0;
+}
+
+int EmpowerLVAPManager::handle_del_probe_policy(Packet *p, uint32_t offset) {
+	struct empower_del_probe_policy *q = (struct empower_del_probe_policy *) (p->data() + offset);
+	EtherAddress sta = q->sta();
+	String ssid = q->ssid();
+	_ebs->del_probe_policy(sta, ssid);
 	return 0;
 }
 
@@ -1639,7 +1926,13 @@ int EmpowerLVAPManager::handle_wifi_stats_request(Packet *p, uint32_t offset) {
 	EtherAddress hwaddr = q->hwaddr();
 	empower_bands_types band = (empower_bands_types) q->band();
 	uint8_t channel = q->channel();
-	send_wifi_stats_response(q->wifi_stats_id(), hwaddr, channel, band);
+	// requests carrying a time range get aggregated min/avg/max entries
+	if (q->length() >= sizeof(empower_wifi_stats_range_request)) {
+		struct empower_wifi_stats_range_request *r = (struct empower_wifi_stats_range_request *) q;
+		send_wifi_stats_response(q->wifi_stats_id(), hwaddr, channel, band, true, r->window(), r->resolution());
+		return 0;
+	}
+	send_wifi_stats_response(q->wifi_stats_id(), hwaddr, channel, band, false, 0, 0);
 	return 0;
 }
 
@@ -1683,8 +1976,15 @@ int EmpowerLVAPManager::handle_set_slice(Packet *p, uint32_t offset) {
 	uint32_t quantum = add_slice->quantum();
 	bool amsdu_aggregation = add_slice->flags(EMPOWER_AMSDU_AGGREGATION);
 	uint32_t scheduler = add_slice->scheduler();
+	uint32_t aqm = 0;
+
+	if (add_slice->flags(EMPOWER_AQM_FQ_CODEL)) {
+		aqm = EMPOWER_AQM_FQ_CODEL;
+	} else if (add_slice->flags(EMPOWER_AQM_CODEL)) {
+		aqm = EMPOWER_AQM_CODEL;
+	}
 
-	_eqms[iface_id]->set_slice(ssid, dscp, quantum, amsdu_aggregation, scheduler);
+	_eqms[iface_id]->set_slice(ssid, dscp, quantum, amsdu_aggregation, scheduler, aqm);
 
 	return 0;
 
@@ -1712,23 +2012,57 @@ int EmpowerLVAPManager::handle_del_slice(Packet *p, uint32_t offset) {
 void EmpowerLVAPManager::push(int, Packet *p) {
 
 	/* This is a control packet coming from a Socket
-	 * element.
+	 * element. The controller talks over a stream socket, so
+	 * a packet may hold several messages and a message may span
+	 * several packets. The bytes of an incomplete message are
+	 * kept and prepended to the next packet.
 	 */
 
-	if (p->length() < sizeof(struct empower_header)) {
-		click_chatter("%{element} :: %s :: Packet too small: %d Vs. %d",
-				      this,
-				      __func__,
-				      p->length(),
-				      sizeof(struct empower_header));
+	if (_rx_desync) {
+		// message boundaries were lost, wait for a reconnect
+		_rx_discarded += p->length();
 		p->kill();
 		return;
 	}
 
+	if (_rx_partial) {
+		WritablePacket *q = Packet::make(_rx_partial->length() + p->length());
+		if (!q) {
+			click_chatter("%{element} :: %s :: cannot make packet!",
+					      this,
+					      __func__);
+			reset_channel();
+			p->kill();
+			return;
+		}
+		memcpy(q->data(), _rx_partial->data(), _rx_partial->length());
+		memcpy(q->data() + _rx_partial->length(), p->data(), p->length());
+		_rx_partial->kill();
+		_rx_partial = 0;
+		_rx_reassembled++;
+		p->kill();
+		p = q;
+	}
+
 	uint32_t offset = 0;
 
-	while (offset < p->length()) {
+	while (p->length() - offset >= sizeof(struct empower_header)) {
 		struct empower_header *w = (struct empower_header *) (p->data() + offset);
+		uint32_t len = w->length();
+		if (len < sizeof(struct empower_header) || len > MAX_MESSAGE_LENGTH) {
+			click_chatter("%{element} :: %s :: invalid message length %u, discarding inbound data and hellos until reconnect",
+					      this,
+					      __func__,
+					      len);
+			reset_channel();
+			_rx_desync = true;
+			_rx_discarded += p->length() - offset;
+			p->kill();
+			return;
+		}
+		if (p->length() - offset < len) {
+			break;
+		}
 		switch (w->type()) {
 		case EMPOWER_PT_ADD_LVAP:
 			handle_add_lvap(p, offset);
@@ -1811,13 +2145,26 @@ void EmpowerLVAPManager::push(int, Packet *p) {
 		case EMPOWER_PT_PORT_STATUS_REQ:
 			handle_port_status_request(p, offset);
 			break;
+		case EMPOWER_PT_SET_PROBE_POLICY:
+			handle_set_probe_policy(p, offset);
+			break;
+		case EMPOWER_PT_DEL_PROBE_POLICY:
+			handle_del_probe_policy(p, offset);
+			break;
 		default:
 			click_chatter("%{element} :: %s :: Unknown packet type: %d",
 					      this,
 					      __func__,
 					      w->type());
 		}
-		offset += w->length();
+		offset += len;
+		_rx_messages++;
+	}
+
+	if (offset < p->length()) {
+		p->pull(offset);
+		_rx_partial = p;
+		return;
 	}
 
 	p->kill();
@@ -1825,6 +2172,50 @@ void EmpowerLVAPManager::push(int, Packet *p) {
 
 }
 
+/*
+ * Drops the beacon and probe response templates of all the networks
+ * advertised by this LVAP.
+ */
+void EmpowerLVAPManager::invalidate_beacons(EmpowerStationState *ess) {
+	for (int i = 0; i < ess->_networks.size(); i++) {
+		_ebs->invalidate_templates(ess->_networks[i]._bssid);
+	}
+}
+
+/*
+ * Builds a new immutable snapshot of the LVAPs for the data path and
+ * publishes it. The previous snapshot is retired and freed by the timer
+ * once no reader can be using it anymore (RCU-style). Must be called by
+ * the control path with the write lock held or from the only writer.
+ */
+void EmpowerLVAPManager::update_station_index() {
+
+	StationIndex *index = new StationIndex();
+
+	for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
+		EmpowerStationState *ess = &it.value();
+		EmpowerStationView view;
+		view._sta = ess->_sta;
+		view._bssid = ess->_bssid;
+		view._ssid = ess->_ssid;
+		view._encap = ess->_encap;
+		view._iface_id = ess->_iface_id;
+		view._set_mask = ess->_set_mask;
+		view._authentication_status = ess->_authentication_status;
+		view._association_status = ess->_association_status;
+		view._valid = ess->is_valid(ess->_iface_id);
+		view._max_amsdu_length = (ess->_supported_band == EMPOWER_BT_HT20) ? ess->_max_amsdu_length : 0;
+		view._txp = _rcs[ess->_iface_id]->tx_policies()->lookup(ess->_sta);
+		index->set(ess->_sta, view);
+	}
+
+	StationIndex *old = _station_index;
+	click_write_fence();
+	_station_index = index;
+	_retired_indexes.push_back(old);
+
+}
+
 Vector<EtherAddress>::iterator find(Vector<EtherAddress>::iterator begin, Vector<EtherAddress>::iterator end, EtherAddress element) {
 	while (begin != end) {
 		if (*begin == element) {
@@ -1841,86 +2232,80 @@ Vector<EtherAddress>::iterator find(Vector<EtherAddress>::iterator begin, Vector
  * using all the BSSIDs of the VAPs, and sets the
  * hardware register accordingly.
  */
-void EmpowerLVAPManager::compute_bssid_mask() {
+/*
+ * Adds (delta 1) or removes (delta -1) a BSSID hosted on an interface to
+ * its mask. The debugfs file is updated by the mask timer, so that a burst
+ * of changes results in at most one write.
+ */
+void EmpowerLVAPManager::update_bssid_mask(int iface_id, EtherAddress bssid, int delta) {
+	if (iface_id < 0 || iface_id >= _bssid_masks.size()) {
+		return;
+	}
+	_bssid_masks[iface_id].update(bssid, delta);
+	if (!_mask_timer.scheduled()) {
+		_mask_timer.schedule_now();
+	}
+}
 
-	// clear _masks vector
-	_masks.clear();
+/*
+ * Adds or removes the BSSIDs of all the networks of an LVAP, if the LVAP
+ * is DL+UL.
+ */
+void EmpowerLVAPManager::update_bssid_mask(const EmpowerStationState *ess, int delta) {
+	if (!ess->_set_mask) {
+		return;
+	}
+	for (int i = 0; i < ess->_networks.size(); i++) {
+		update_bssid_mask(ess->_iface_id, ess->_networks[i]._bssid, delta);
+	}
+}
 
-	for (unsigned j = 0; j < _ifaces_to_elements.size(); j++) {
+/*
+ * Writes the masks that changed since the last write (or all of them if
+ * force is true) to the bssid_extra debugfs files.
+ */
+void EmpowerLVAPManager::write_bssid_masks(bool force) {
 
-		// start building mask
-		uint8_t bssid_mask[6];
-		int i;
+	for (int i = 0; i < _bssid_masks.size(); i++) {
 
-		// Start with a mask of ff:ff:ff:ff:ff:ff
-		for (i = 0; i < 6; i++) {
-			bssid_mask[i] = 0xff;
-		}
+		EtherAddress mask = _bssid_masks[i].mask();
 
-		// For each LVAP, update the bssid mask to include
-		// the common bits of all LVAPs.
-		for (LVAPIter it = _lvaps.begin(); it.live(); it++) {
-			// check iface
-			unsigned iface_id = it.value()._iface_id;
-			if (iface_id != j) {
-				continue;
-			}
-			// check if lvap is DL+UL
-			if (!it.value()._set_mask) {
-				continue;
-			}
-			// add each bssid in the networks
-			const uint8_t *hw = (const uint8_t *) _ifaces_to_elements[iface_id]->_hwaddr.data();
-			for (int k = 0; k < it.value()._networks.size(); k ++) {
-				const uint8_t *bssid = (const uint8_t *) it.value()._networks[k]._bssid.data();
-				for (i = 0; i < 6; i++) {
-					bssid_mask[i] &= ~(hw[i] ^ bssid[i]);
-				}
-			}
+		if (!force && mask == _masks[i]) {
+			continue;
 		}
 
-		// For each VAP, update the bssid mask to include
-		// the common bits of all VAPs.
-		for (VAPIter it = _vaps.begin(); it.live(); it++) {
-			// check iface
-			unsigned iface_id = it.value()._iface_id;
-			if (iface_id != j) {
-				continue;
-			}
-			// add to mask
-			const uint8_t *hw = (const uint8_t *) _ifaces_to_elements[iface_id]->_hwaddr.data();
-			for (i = 0; i < 6; i++) {
-				const uint8_t *bssid = (const uint8_t *) it.value()._bssid.data();
-				bssid_mask[i] &= ~(hw[i] ^ bssid[i]);
-			}
-		}
+		_masks[i] = mask;
 
-		_masks.push_back(EtherAddress(bssid_mask));
+		if (_debugfs_fds[i] < 0) {
+			_debugfs_fds[i] = open(_debugfs_strings[i].c_str(), O_WRONLY);
+		}
 
-	}
+		if (_debugfs_fds[i] < 0) {
+			click_chatter("%{element} :: %s :: unable to open debugfs file %s",
+						  this,
+						  __func__,
+						  _debugfs_strings[i].c_str());
+			continue;
+		}
 
-	// Update bssid masks register through debugfs
-	for (int i = 0; i < _masks.size(); i++) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: %s",
+						  this,
+						  __func__,
+						  mask.unparse_colon().c_str());
+		}
 
-		FILE *debugfs_file = fopen(_debugfs_strings[i].c_str(), "w");
+		String line = mask.unparse_colon() + "\n";
 
-		if (debugfs_file != NULL) {
-			if (_debug) {
-				click_chatter("%{element} :: %s :: %s",
-							  this,
-							  __func__,
-							  _masks[i].unparse_colon().c_str());
-			}
-			fprintf(debugfs_file, "%s\n", _masks[i].unparse_colon().c_str());
-			fclose(debugfs_file);
-			continue;
+		if (pwrite(_debugfs_fds[i], line.data(), line.length(), 0) < 0) {
+			click_chatter("%{element} :: %s :: unable to write debugfs file %s",
+						  this,
+						  __func__,
+						  _debugfs_strings[i].c_str());
+			close(_debugfs_fds[i]);
+			_debugfs_fds[i] = -1;
 		}
 
-		click_chatter("%{element} :: %s :: unable to open debugfs file %s",
-					  this,
-					  __func__,
-					  _debugfs_strings[i].c_str());
-
 	}
 
 }
@@ -1936,6 +2321,7 @@ enum {
 	H_DEL_LVAP,
 	H_RECONNECT,
 	H_INTERFACES,
+	H_CHANNEL,
 };
 
 String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
@@ -2010,6 +2396,17 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 		}
 		return sa.take_string();
 	}
+	case H_CHANNEL: {
+		StringAccum sa;
+		sa << "rx_messages " << td->_rx_messages << "\n";
+		sa << "rx_reassembled " << td->_rx_reassembled << "\n";
+		sa << "rx_partial " << (td->_rx_partial ? td->_rx_partial->length() : 0) << "\n";
+		sa << "rx_desync " << td->_rx_desync << "\n";
+		sa << "rx_discarded " << td->_rx_discarded << "\n";
+		sa << "tx_messages " << td->_tx_messages << "\n";
+		sa << "tx_batches " << td->_tx_batches << "\n";
+		return sa.take_string();
+	}
 	case H_VAPS: {
 	    StringAccum sa;
 		for (VAPIter it = td->vaps()->begin(); it.live(); it++) {
@@ -2035,27 +2432,19 @@ String EmpowerLVAPManager::read_handler(Element *e, void *thunk) {
 			TxPolicyInfo *txp = td->get_txp(it.key());
 			sa << "!" << it.key().unparse() << "\n";
 			sa << "!TX\n";
-			CBytes tx = txp->_tx;
-			Vector<int> lens_tx;
-			for (CBytesIter iter = tx.begin(); iter.live(); iter++) {
-				lens_tx.push_back(iter.key());
-			}
-			click_qsort(lens_tx.begin(), lens_tx.size());
-			for (int i = 0; i < lens_tx.size(); i++) {
-				CBytesIter itr = tx.find(lens_tx[i]);
-				sa << itr.key() << " " << itr.value() << "\n";
+			for (int i = 0; i < FrameHistogram::NB_BUCKETS; i++) {
+				if (txp->_tx._buckets[i]) {
+					sa << FrameHistogram::lower_bound(i) << " " << txp->_tx._buckets[i] << "\n";
+				}
 			}
+			sa << "packets " << txp->_tx._packets << " bytes " << txp->_tx._bytes << "\n";
 			sa << "!RX\n";
-			CBytes rx = txp->_rx;
-			Vector<int> lens_rx;
-			for (CBytesIter iter = rx.begin(); iter.live(); iter++) {
-				lens_rx.push_back(iter.key());
-			}
-			click_qsort(lens_rx.begin(), lens_rx.size());
-			for (int i = 0; i < lens_rx.size(); i++) {
-				CBytesIter itr = rx.find(lens_rx[i]);
-				sa << itr.key() << " " << itr.value() << "\n";
+			for (int i = 0; i < FrameHistogram::NB_BUCKETS; i++) {
+				if (txp->_rx._buckets[i]) {
+					sa << FrameHistogram::lower_bound(i) << " " << txp->_rx._buckets[i] << "\n";
+				}
 			}
+			sa << "packets " << txp->_rx._packets << " bytes " << txp->_rx._bytes << "\n";
 		}
 		return sa.take_string();
 	}
@@ -2116,8 +2505,13 @@ int EmpowerLVAPManager::write_handler(const String &in_s, Element *e,
 
 	}
 	case H_RECONNECT: {
+		// drop partial messages of the previous connection
+		f->reset_channel();
+		f->_rx_desync = false;
 		// clear triggers
 		f->_ers->clear_triggers();
+		// clear probe policies
+		f->_ebs->clear_probe_policies();
 		// send hello
 		f->send_hello();
 		break;
@@ -2134,6 +2528,7 @@ void EmpowerLVAPManager::add_handlers() {
 	add_read_handler("masks", read_handler, (void *) H_MASKS);
 	add_read_handler("bytes", read_handler, (void *) H_BYTES);
 	add_read_handler("interfaces", read_handler, (void *) H_INTERFACES);
+	add_read_handler("channel", read_handler, (void *) H_CHANNEL);
 	add_write_handler("reconnect", write_handler, (void *) H_RECONNECT);
 	add_write_handler("ports", write_handler, (void *) H_PORTS);
 	add_write_handler("debug", write_handler, (void *) H_DEBUG);
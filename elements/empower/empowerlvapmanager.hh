@@ -8,6 +8,8 @@
 #include <click/hashtable.hh>
 #include <clicknet/wifi.h>
 #include <click/sync.hh>
+#include <click/machine.hh>
+#include <click/integers.hh>
 #include <elements/wifi/minstrel.hh>
 #include "empowerrxstats.hh"
 #include "empowerpacket.hh"
@@ -57,11 +59,26 @@ An EmpowerDeAuthResponder element
 =item EDISASSOR
 An EmpowerDisassocResponder element
 
+=item FLUSH_LATENCY
+Maximum time outbound messages are held to be sent together to the Access
+Controller (in usec). Default is 0, messages generated in the same
+scheduling round are sent together
+
+=item MAX_BATCH
+Outbound messages are sent as soon as this many bytes are pending. Default
+is 65536
+
 =item DEBUG
 Turn debug on/off
 
 =back 8
 
+Messages from the Access Controller are read as a byte stream: a packet may
+carry several messages and a message may span several packets. A message
+with an invalid length means the stream is out of sync: inbound data is
+then discarded and no hello is sent, so that the Access Controller times
+the agent out, until the reconnect handler is written.
+
 =a EmpowerLVAPManager
 */
 
@@ -81,7 +98,9 @@ enum empower_bands_types {
 };
 
 enum empower_aggregation_flags {
-	EMPOWER_AMSDU_AGGREGATION = (1<<0)
+	EMPOWER_AMSDU_AGGREGATION = (1<<0),
+	EMPOWER_AQM_CODEL = (1<<1),
+	EMPOWER_AQM_FQ_CODEL = (1<<2)
 };
 
 enum empower_slice_scheduleruler {
@@ -95,8 +114,10 @@ enum empower_regmon_types {
 	EMPOWER_REGMON_ED = 0x2,
 };
 
-typedef HashTable<uint16_t, uint32_t> CBytes;
-typedef CBytes::iterator CBytesIter;
+enum empower_probe_policy_actions {
+	EMPOWER_PROBE_RESPOND = 0x0,
+	EMPOWER_PROBE_DROP = 0x1,
+};
 
 class Minstrel;
 class EmpowerQOSManager;
@@ -133,6 +154,24 @@ public:
 	int _iface_id;
 };
 
+// Probe requests from a station for an SSID on an interface that were
+// not forwarded to the controller, reported in batches
+class ProbeReport {
+public:
+	EtherAddress _sta;
+	String _ssid;
+	int _iface_id;
+	empower_bands_types _supported_band;
+	int _rssi;
+	uint32_t _responded;
+	uint32_t _dropped;
+	uint32_t _limited;
+	ProbeReport() :
+			_iface_id(0), _supported_band(EMPOWER_BT_L20), _rssi(0),
+			_responded(0), _dropped(0), _limited(0) {
+	}
+};
+
 // An EmPOWER Network. This is a tuple BSSID/SSID to be advertised
 // the LVAP
 class EmpowerNetwork {
@@ -163,6 +202,7 @@ public:
 	int _channel;
 	empower_bands_types _band;
 	empower_bands_types _supported_band;
+	uint32_t _max_amsdu_length; // advertised in the HT capabilities
 	int _iface_id;
 	bool _set_mask;
 	bool _authentication_status;
@@ -191,6 +231,30 @@ public:
 	}
 };
 
+// Read-only copy of the LVAP fields needed by the data path. Views
+// are grouped in immutable snapshots (see StationIndex) which are
+// rebuilt by the control path every time an LVAP changes, so that
+// per-frame lookups never need to take the LVAP manager lock.
+class EmpowerStationView {
+public:
+	EtherAddress _sta;
+	EtherAddress _bssid;
+	String _ssid;
+	EtherAddress _encap;
+	int _iface_id;
+	bool _set_mask;
+	bool _authentication_status;
+	bool _association_status;
+	bool _valid;
+	uint32_t _max_amsdu_length; // 0 if the station is not HT
+	TxPolicyInfo *_txp;
+	bool is_valid(int iface_id) const {
+		return _valid && _iface_id == iface_id;
+	}
+};
+
+typedef HashTable<EtherAddress, EmpowerStationView> StationIndex;
+
 // Cross structure mapping bssids to list of associated
 // station and to the interface id
 class InfoBssid {
@@ -259,6 +323,47 @@ inline bool operator==(const ResourceElement &a, const ResourceElement &b) {
 typedef HashTable<int, ResourceElement *> RETable;
 typedef RETable::const_iterator REIter;
 
+/*
+ * BSSID mask of an interface, maintained incrementally. For each of the 48
+ * address bits it counts the BSSIDs hosted on the interface that differ from
+ * the interface address in that bit, a bit is set in the mask only when no
+ * BSSID differs there.
+ */
+class BssidMask {
+public:
+
+	EtherAddress _hwaddr;
+	uint32_t _refs[48];
+
+	BssidMask() : _hwaddr(EtherAddress()) {
+		memset(_refs, 0, sizeof(_refs));
+	}
+
+	void update(EtherAddress bssid, int delta) {
+		const uint8_t *hw = _hwaddr.data();
+		const uint8_t *b = bssid.data();
+		for (int i = 0; i < 6; i++) {
+			for (unsigned diff = hw[i] ^ b[i]; diff; diff &= diff - 1) {
+				_refs[i * 8 + ffs_lsb(diff) - 1] += delta;
+			}
+		}
+	}
+
+	EtherAddress mask() const {
+		uint8_t mask[6];
+		for (int i = 0; i < 6; i++) {
+			mask[i] = 0xff;
+			for (int j = 0; j < 8; j++) {
+				if (_refs[i * 8 + j]) {
+					mask[i] &= ~(1 << j);
+				}
+			}
+		}
+		return EtherAddress(mask);
+	}
+
+};
+
 class EmpowerLVAPManager: public Element {
 public:
 
@@ -305,9 +410,12 @@ public:
 	int handle_slice_queue_counters_request(Packet *, uint32_t);
 	int handle_slice_status_request(Packet *, uint32_t);
 	int handle_port_status_request(Packet *, uint32_t);
+	int handle_set_probe_policy(Packet *, uint32_t);
+	int handle_del_probe_policy(Packet *, uint32_t);
 
 	void send_hello();
 	void send_probe_request(EtherAddress, String, EtherAddress, int, empower_bands_types, empower_bands_types);
+	void send_probe_report(const Vector<ProbeReport> &);
 	void send_auth_request(EtherAddress, EtherAddress);
 	void send_association_request(EtherAddress, EtherAddress, String, EtherAddress, int, empower_bands_types, empower_bands_types);
 	void send_status_lvap(EtherAddress);
@@ -317,7 +425,7 @@ public:
 	void send_counters_response(EtherAddress, uint32_t);
 	void send_txp_counters_response(uint32_t, EtherAddress, uint8_t, empower_bands_types, EtherAddress);
 	void send_img_response(int, uint32_t, EtherAddress, uint8_t, empower_bands_types);
-	void send_wifi_stats_response(uint32_t, EtherAddress, uint8_t, empower_bands_types);
+	void send_wifi_stats_response(uint32_t, EtherAddress, uint8_t, empower_bands_types, bool, uint32_t, uint32_t);
 	void send_caps();
 	void send_rssi_trigger(uint32_t, uint32_t, uint8_t);
 	void send_summary_trigger(SummaryTrigger *);
@@ -342,11 +450,22 @@ public:
 		_rcs[ess->_iface_id]->tx_policies()->tx_table()->erase(ess->_sta);
 		_rcs[ess->_iface_id]->forget_station(ess->_sta);
 
-		// Erase lvap
-		_lvaps.erase(_lvaps.find(ess->_sta));
+		// Drop cached beacons
+		invalidate_beacons(ess);
+
+		// Remove this LVAP's BSSIDs from the mask
+		update_bssid_mask(ess, -1);
+
+		// Leave the multicast groups joined by the station
+		if (_mtbl) {
+			_mtbl->leave_all_groups(ess->_sta);
+		}
 
-		// Remove this VAP's BSSID from the mask
-		compute_bssid_mask();
+		// Erase lvap and publish new station index
+		_lock.acquire_write();
+		_lvaps.erase(_lvaps.find(ess->_sta));
+		update_station_index();
+		_lock.release_write();
 
 		return 0;
 
@@ -373,6 +492,17 @@ public:
 		return _lvaps.get_pointer(sta);
 	}
 
+	// Lock-free lookup used by the data path. The returned view stays
+	// valid for at least one PERIOD after the snapshot it belongs to
+	// has been replaced.
+	const EmpowerStationView * get_station(EtherAddress sta) {
+		const StationIndex *index = _station_index;
+		click_read_fence();
+		return index->get_pointer(sta);
+	}
+
+	void update_station_index();
+
 	TxPolicyInfo * get_txp(EtherAddress sta) {
 		EmpowerStationState *ess = _lvaps.get_pointer(sta);
 		if (!ess) {
@@ -409,8 +539,13 @@ private:
 
 	RETable _ifaces_to_elements;
 
-	void compute_bssid_mask();
+	void update_bssid_mask(int, EtherAddress, int);
+	void update_bssid_mask(const EmpowerStationState *, int);
+	void write_bssid_masks(bool);
+	void invalidate_beacons(EmpowerStationState *);
 	void send_message(Packet *);
+	void flush_messages();
+	void reset_channel();
 
 	class Empower11k *_e11k;
 	class EmpowerBeaconSource *_ebs;
@@ -421,20 +556,46 @@ private:
 	class EmpowerMulticastTable * _mtbl;
 
 	LVAP _lvaps;
+	StationIndex * volatile _station_index;
+	Vector<StationIndex *> _retired_indexes;
+	Vector<StationIndex *> _expired_indexes;
 	Ports _ports;
 	VAP _vaps;
 	Vector<EtherAddress> _masks;
+	Vector<BssidMask> _bssid_masks;
+	Vector<int> _debugfs_fds;
 	Vector<Minstrel *> _rcs;
 	Vector<EmpowerRegmon *> _regmons;
 	Vector<EmpowerQOSManager *> _eqms;
 	Vector<String> _debugfs_strings;
 	Timer _timer;
+	Timer _flush_timer;
+	Timer _mask_timer;
 	uint32_t _seq;
 	EtherAddress _wtp;
 	uint8_t _dpid[8];
 	unsigned int _period; // msecs
 	bool _debug;
 
+	enum { MAX_MESSAGE_LENGTH = 1 << 20 };
+
+	// control channel, bytes of an incomplete inbound message and
+	// outbound messages waiting to be flushed. After a framing error
+	// the inbound stream is discarded until the channel is reconnected
+	Packet *_rx_partial;
+	bool _rx_desync;
+	uint32_t _rx_discarded;
+	SimpleSpinlock _tx_lock;
+	SimpleSpinlock _flush_lock;
+	Vector<Packet *> _tx_pending;
+	uint32_t _tx_pending_bytes;
+	unsigned _flush_latency; // usecs
+	unsigned _max_batch; // bytes
+	uint32_t _rx_messages;
+	uint32_t _rx_reassembled;
+	uint32_t _tx_messages;
+	uint32_t _tx_batches;
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
 
@@ -53,132 +53,164 @@ bool EmpowerMulticastTable::add_group(IPAddress group) {
 					  group.unparse().c_str());
 	}
 
-    Vector<EmpowerMulticastGroup>::iterator i;
-    for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-        if (i->group == group) {
-            return false;
-        }
-    }
+	if (_groups.find(group) != _groups.end()) {
+		return false;
+	}
 
-    EmpowerMulticastGroup newgroup;
+	EmpowerMulticastGroup newgroup;
 
-    newgroup.group = group;
-    newgroup.mac_group = ip_mcast_addr_to_mac(group);
+	newgroup.group = group;
+	newgroup.mac_group = ip_mcast_addr_to_mac(group);
 
-    multicastgroups.push_back(newgroup);
+	_groups.set(group, newgroup);
+	_mac_groups[newgroup.mac_group].push_back(group);
 
-    return true;
+	return true;
 
 }
 
 bool EmpowerMulticastTable::join_group(EtherAddress sta, IPAddress group) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->group == group) {
-			Vector<EtherAddress>::iterator a;
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				if (*a == sta) {
-					if (_debug) {
-						click_chatter("%{element} :: %s :: Station %s already in IGMP group %s.",
-									  this,
-									  __func__,
-									  sta.unparse().c_str(),
-									  group.unparse().c_str());
-					}
-					return false;
-				}
-			}
-			i->receivers.push_back(sta);
-			if (_debug) {
-				click_chatter("%{element} :: %s :: Station %s added to IGMP group %s.",
-							  this,
-							  __func__,
-							  sta.unparse().c_str(),
-							  group.unparse().c_str());
-			}
-			return true;
+	EmpowerMulticastGroup *mg = _groups.get_pointer(group);
+
+	if (!mg) {
+		return false;
+	}
+
+	if (!mg->receivers.insert(sta)) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: Station %s already in IGMP group %s.",
+						  this,
+						  __func__,
+						  sta.unparse().c_str(),
+						  group.unparse().c_str());
 		}
+		return false;
 	}
 
-	return false;
+	_sta_groups[sta].push_back(group);
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: Station %s added to IGMP group %s.",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  group.unparse().c_str());
+	}
+
+	return true;
 
 }
 
 bool EmpowerMulticastTable::leave_group(EtherAddress sta, IPAddress group) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->group == group) {
-			Vector<EtherAddress>::iterator a;
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				if (*a == sta) {
-					i->receivers.erase(a);
-					if (_debug) {
-						click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
-									  this,
-									  __func__,
-									  sta.unparse().c_str(),
-									  group.unparse().c_str());
-					}
-					// The group is deleted if no more receivers belong to it
-					if (i->receivers.begin() == i->receivers.end()) {
-						multicastgroups.erase(i);
-						if (_debug) {
-							click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
-										  this,
-										  __func__,
-										  group.unparse().c_str());
-						}
-					}
-					return true;
-				}
-			}
+	EmpowerMulticastGroup *mg = _groups.get_pointer(group);
+
+	if (!mg || mg->receivers.find(sta) < 0) {
+		return false;
+	}
+
+	// forget the group in the station index
+	MSIter it = _sta_groups.find(sta);
+	Vector<IPAddress> &groups = it.value();
+	for (int i = 0; i < groups.size(); i++) {
+		if (groups[i] == group) {
+			groups[i] = groups.back();
+			groups.pop_back();
+			break;
 		}
 	}
+	if (groups.empty()) {
+		_sta_groups.erase(it);
+	}
 
-	return false;
+	remove_receiver(mg, sta);
+
+	return true;
 
 }
 
 bool EmpowerMulticastTable::leave_all_groups(EtherAddress sta) {
 
-	Vector<EmpowerMulticastGroup>::iterator i;
-	for (i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		Vector<EtherAddress>::iterator a;
-		for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-			if (*a == sta) {
-				i->receivers.erase(a);
-				click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
-							  this,
-							  __func__,
-							  sta.unparse().c_str(),
-							  i->group.unparse().c_str());
-				// The group is deleted if no more receivers belong to it
-				if (i->receivers.begin() == i->receivers.end()) {
-					multicastgroups.erase(i);
-					click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
-								  this,
-								  __func__,
-								  i->group.unparse().c_str());
-				}
-			}
+	MSIter it = _sta_groups.find(sta);
+
+	if (it == _sta_groups.end()) {
+		return true;
+	}
+
+	Vector<IPAddress> &groups = it.value();
+	for (int i = 0; i < groups.size(); i++) {
+		EmpowerMulticastGroup *mg = _groups.get_pointer(groups[i]);
+		if (mg) {
+			remove_receiver(mg, sta);
 		}
 	}
 
+	_sta_groups.erase(it);
+
 	return true;
 
 }
 
-Vector<EtherAddress>* EmpowerMulticastTable::get_receivers(EtherAddress group) {
+void EmpowerMulticastTable::remove_receiver(EmpowerMulticastGroup *mg, EtherAddress sta) {
+
+	mg->receivers.remove(sta);
+
+	if (_debug) {
+		click_chatter("%{element} :: %s :: Station %s removed from IGMP group %s",
+					  this,
+					  __func__,
+					  sta.unparse().c_str(),
+					  mg->group.unparse().c_str());
+	}
 
-	for (MGIter i = multicastgroups.begin(); i != multicastgroups.end(); i++) {
-		if (i->mac_group == group) {
-			return &(i->receivers);
+	// The group is deleted if no more receivers belong to it
+	if (mg->receivers.empty()) {
+		if (_debug) {
+			click_chatter("%{element} :: %s :: IGMP group %s is empty. Remove it.",
+						  this,
+						  __func__,
+						  mg->group.unparse().c_str());
 		}
+		remove_group(mg);
 	}
 
-	return 0;
+}
+
+void EmpowerMulticastTable::remove_group(EmpowerMulticastGroup *mg) {
+
+	IPAddress group = mg->group;
+	MMIter it = _mac_groups.find(mg->mac_group);
+
+	if (it != _mac_groups.end()) {
+		Vector<IPAddress> &groups = it.value();
+		for (int i = 0; i < groups.size(); i++) {
+			if (groups[i] == group) {
+				groups.erase(groups.begin() + i);
+				break;
+			}
+		}
+		if (groups.empty()) {
+			_mac_groups.erase(it);
+		}
+	}
+
+	_groups.erase(group);
+
+}
+
+Vector<EtherAddress>* EmpowerMulticastTable::get_receivers(EtherAddress group) {
+
+	MMIter it = _mac_groups.find(group);
+
+	if (it == _mac_groups.end()) {
+		return 0;
+	}
+
+	// the oldest group with this MAC address
+	EmpowerMulticastGroup *mg = _groups.get_pointer(it.value()[0]);
+
+	return mg ? &mg->receivers._stas : 0;
 
 }
 
@@ -194,17 +226,16 @@ String EmpowerMulticastTable::read_handler(Element *e, void *thunk) {
 		return String(td->_debug) + "\n";
 	case H_MULTICAST_TABLE: {
 		StringAccum sa;
-		Vector<EmpowerMulticastGroup>::iterator i;
-		for (i = td->multicastgroups.begin(); i != td->multicastgroups.end(); i++) {
-			sa << i->group.unparse() << " " << i->mac_group.unparse();
-			Vector<EtherAddress>::iterator a;
+		for (MGIter i = td->_groups.begin(); i.live(); i++) {
+			const Vector<EtherAddress> &receivers = i.value().receivers._stas;
+			sa << i.value().group.unparse() << " " << i.value().mac_group.unparse();
 			sa << " receivers [ ";
-			for (a = i->receivers.begin(); a != i->receivers.end(); a++) {
-				sa << a->unparse();
-				if (a != i->receivers.end())
+			for (int a = 0; a < receivers.size(); a++) {
+				if (a > 0)
 					sa << ", ";
+				sa << receivers[a].unparse();
 			}
-			sa << "]\n";
+			sa << " ]\n";
 		}
 		return sa.take_string();
 	}
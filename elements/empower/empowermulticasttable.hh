@@ -4,6 +4,9 @@
 #include <click/element.hh>
 #include <click/config.h>
 #include <click/etheraddress.hh>
+#include <click/ipaddress.hh>
+#include <click/hashtable.hh>
+#include <click/vector.hh>
 CLICK_DECLS
 
 /*
@@ -35,15 +38,88 @@ Turn debug on/off
 =a EmpowerLVAPManager
 */
 
+// Receivers of a multicast group. Most groups have a handful of
+// receivers which are simply scanned, larger groups also keep a hash
+// index into the receivers vector. The vector stays dense so that the
+// downlink path can walk it for every packet.
+class MulticastReceivers {
+public:
+
+	enum { SMALL_SIZE = 8 };
+
+	Vector<EtherAddress> _stas;
+	HashTable<EtherAddress, int> _index;
+
+	int size() const { return _stas.size(); }
+	bool empty() const { return _stas.empty(); }
+
+	int find(EtherAddress sta) const {
+		if (_stas.size() <= SMALL_SIZE) {
+			for (int i = 0; i < _stas.size(); i++) {
+				if (_stas[i] == sta) {
+					return i;
+				}
+			}
+			return -1;
+		}
+		HashTable<EtherAddress, int>::const_iterator it = _index.find(sta);
+		return it.live() ? it.value() : -1;
+	}
+
+	bool insert(EtherAddress sta) {
+		if (find(sta) >= 0) {
+			return false;
+		}
+		_stas.push_back(sta);
+		if (_stas.size() == SMALL_SIZE + 1) {
+			for (int i = 0; i < _stas.size(); i++) {
+				_index.set(_stas[i], i);
+			}
+		} else if (_stas.size() > SMALL_SIZE) {
+			_index.set(sta, _stas.size() - 1);
+		}
+		return true;
+	}
+
+	bool remove(EtherAddress sta) {
+		int pos = find(sta);
+		if (pos < 0) {
+			return false;
+		}
+		// move the last receiver in the hole
+		_stas[pos] = _stas.back();
+		_stas.pop_back();
+		if (_stas.size() > SMALL_SIZE) {
+			_index.erase(sta);
+			if (pos < _stas.size()) {
+				_index.set(_stas[pos], pos);
+			}
+		} else {
+			_index.clear();
+		}
+		return true;
+	}
+
+};
+
 struct EmpowerMulticastGroup {
 	IPAddress group; // group address
 	EtherAddress mac_group;
-	Vector<EtherAddress> receivers;
+	MulticastReceivers receivers;
 };
 
-typedef Vector<EmpowerMulticastGroup> MulticastGroups;
+// Groups by IP address. Several IP groups map to the same MAC address,
+// the downlink path looks groups up by MAC address through a second
+// index that holds the IP addresses of the groups, oldest first.
+typedef HashTable<IPAddress, EmpowerMulticastGroup> MulticastGroups;
 typedef MulticastGroups::iterator MGIter;
 
+typedef HashTable<EtherAddress, Vector<IPAddress> > MulticastMacIndex;
+typedef MulticastMacIndex::iterator MMIter;
+
+// Groups joined by each station
+typedef HashTable<EtherAddress, Vector<IPAddress> > MulticastStaIndex;
+typedef MulticastStaIndex::iterator MSIter;
 
 class EmpowerMulticastTable: public Element {
 public:
@@ -57,8 +133,6 @@ public:
 	int configure(Vector<String> &, ErrorHandler *);
 	void add_handlers();
 
-	MulticastGroups multicastgroups;
-
 	EtherAddress ip_mcast_addr_to_mac(IPAddress ip) {
 
 		unsigned long ip_addr = ntohl(ip.addr());
@@ -82,6 +156,13 @@ public:
 
 private:
 
+	MulticastGroups _groups;
+	MulticastMacIndex _mac_groups;
+	MulticastStaIndex _sta_groups;
+
+	void remove_receiver(EmpowerMulticastGroup *, EtherAddress);
+	void remove_group(EmpowerMulticastGroup *);
+
 	bool _debug;
 
 	// Read/Write handlers
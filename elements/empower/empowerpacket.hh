@@ -89,6 +89,11 @@ enum empower_packet_types {
     EMPOWER_PT_TXP_COUNTERS_REQUEST = 0x35,         // ac -> wtp
     EMPOWER_PT_TXP_COUNTERS_RESPONSE = 0x36,        // wtp -> ac
 
+    // Local probe responses
+    EMPOWER_PT_SET_PROBE_POLICY = 0x63,             // ac -> wtp
+    EMPOWER_PT_DEL_PROBE_POLICY = 0x64,             // ac -> wtp
+    EMPOWER_PT_PROBE_REPORT = 0x65,                 // wtp -> ac
+
 };
 
 /* header format, common to all messages */
@@ -149,6 +154,64 @@ struct empower_probe_response : public empower_header {
     String ssid()       { return String((char *) _ssid); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* set probe policy packet format */
+struct empower_set_probe_policy : public empower_header {
+  private:
+    uint8_t _sta[6];            /* EtherAddress, broadcast matches any station */
+    uint8_t _action;            /* Policy action (empower_probe_policy_actions) */
+    char _ssid[WIFI_NWID_MAXSIZE+1];    /* Null terminated SSID, empty matches any SSID */
+  public:
+    EtherAddress sta()  { return EtherAddress(_sta); }
+    uint8_t action()    { return _action; }
+    String ssid()       { return String((char *) _ssid); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* del probe policy packet format */
+struct empower_del_probe_policy : public empower_header {
+  private:
+    uint8_t _sta[6];            /* EtherAddress */
+    char _ssid[WIFI_NWID_MAXSIZE+1];    /* Null terminated SSID */
+  public:
+    EtherAddress sta()  { return EtherAddress(_sta); }
+    String ssid()       { return String((char *) _ssid); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* probe report packet format */
+struct empower_probe_report : public empower_header {
+  private:
+    uint8_t  _wtp[6];           /* EtherAddress */
+    uint16_t _nb_entries;       /* Int */
+  public:
+    void set_wtp(EtherAddress wtp)          { memcpy(_wtp, wtp.data(), 6); }
+    void set_nb_entries(uint16_t nb_entries) { _nb_entries = htons(nb_entries); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* probe report entry format */
+struct probe_report_entry {
+  private:
+    uint8_t _sta[6];            /* EtherAddress */
+    uint8_t _hwaddr[6];         /* EtherAddress */
+    uint8_t _channel;           /* WiFi channel (int) */
+    uint8_t _band;              /* WiFi band (empower_bands_types) */
+    uint8_t _supported_band;    /* WiFi band supported by client (empower_bands_types) */
+    int8_t _rssi;               /* RSSI of the last probe request (int) */
+    uint32_t _nb_responded;     /* Probe requests answered locally (int) */
+    uint32_t _nb_dropped;       /* Probe requests dropped by a policy (int) */
+    uint32_t _nb_limited;       /* Probe requests not forwarded because of the rate limit (int) */
+    char _ssid[WIFI_NWID_MAXSIZE+1];    /* Null terminated SSID */
+  public:
+    void set_sta(EtherAddress sta)                  { memcpy(_sta, sta.data(), 6); }
+    void set_hwaddr(EtherAddress hwaddr)            { memcpy(_hwaddr, hwaddr.data(), 6); }
+    void set_channel(uint8_t channel)               { _channel = channel; }
+    void set_band(uint8_t band)                     { _band = band; }
+    void set_supported_band(uint8_t supported_band) { _supported_band = supported_band; }
+    void set_rssi(int8_t rssi)                      { _rssi = rssi; }
+    void set_nb_responded(uint32_t nb_responded)    { _nb_responded = htonl(nb_responded); }
+    void set_nb_dropped(uint32_t nb_dropped)        { _nb_dropped = htonl(nb_dropped); }
+    void set_nb_limited(uint32_t nb_limited)        { _nb_limited = htonl(nb_limited); }
+    void set_ssid(String ssid)                      { memset(_ssid, 0, WIFI_NWID_MAXSIZE+1); memcpy(_ssid, ssid.data(), ssid.length()); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* auth request packet format */
 struct empower_auth_request : public empower_header {
   private:
@@ -290,6 +353,16 @@ public:
     EtherAddress hwaddr()   { return EtherAddress(_hwaddr); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* wifi stats request with time range, answered with wifi_stats_range_entry */
+struct empower_wifi_stats_range_request : public empower_wifi_stats_request {
+private:
+  uint32_t _window;      /* History before the newest sample in ms, 0 for all (int) */
+  uint32_t _resolution;  /* Requested resolution in ms (int) */
+public:
+    uint32_t window()       { return ntohl(_window); }
+    uint32_t resolution()   { return ntohl(_resolution); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* wifi stats entry format */
 struct wifi_stats_entry {
   private:
@@ -302,6 +375,16 @@ struct wifi_stats_entry {
     void set_timestamp(uint32_t timestamp)              { _timestamp = htonl(timestamp); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
+/* wifi stats entry format with the aggregated range */
+struct wifi_stats_range_entry : public wifi_stats_entry {
+  private:
+      uint32_t _min;        /* Minimum sample over the interval (int) */
+      uint32_t _max;        /* Maximum sample over the interval (int) */
+  public:
+    void set_min(uint32_t min)                          { _min = htonl(min); }
+    void set_max(uint32_t max)                          { _max = htonl(max); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
 /* wifi stats response packet format */
 struct empower_wifi_stats_response : public empower_header {
 private:
@@ -415,7 +498,7 @@ public:
 /* counters entry format */
 struct counters_entry {
   private:
-    uint16_t _size;     /* Frame size in bytes (int) */
+    uint16_t _size;     /* Frame size in bytes, bucket mean (int) */
     uint32_t _count;    /* Number of frames (int) */
   public:
     void set_size(uint16_t size)   { _size = htons(size); }
@@ -864,9 +947,15 @@ struct empower_slice_queue_counters_response : public empower_header {
     uint32_t	_queue_delay_usec;  /* Int */
     uint32_t	_deficit_avg;       /* Int */
     uint32_t	_deficit;           /* Int */
+    uint32_t	_queue_delay_ewma;  /* EWMA of the queue delay in usec (int) */
+    uint32_t	_queue_delay_p50;   /* Median queue delay in usec (int) */
+    uint32_t	_queue_delay_p95;   /* 95th percentile of the queue delay in usec (int) */
+    uint32_t	_queue_delay_p99;   /* 99th percentile of the queue delay in usec (int) */
+    uint16_t	_nb_stations;       /* Int */
   public:
     void set_wtp(EtherAddress wtp)                          { memcpy(_wtp, wtp.data(), 6); }
     void set_counters_id(uint32_t counters_id)              { _counters_id = htonl(counters_id); }
+    void set_nb_stations(uint16_t nb_stations)              { _nb_stations = htons(nb_stations); }
     void set_deficit_used(uint32_t deficit_used)            { _deficit_used = htonl(deficit_used); }
     void set_max_queue_length(uint32_t max_queue_length)    { _max_queue_length = htonl(max_queue_length); }
     void set_crr_queue_length(uint32_t crr_queue_length)    { _crr_queue_length = htonl(crr_queue_length); }
@@ -876,6 +965,32 @@ struct empower_slice_queue_counters_response : public empower_header {
     void set_queue_delay_usec(uint32_t queue_delay_usec)    { _queue_delay_usec = htonl(queue_delay_usec); }
     void set_deficit_avg(uint32_t deficit_avg)    			{ _deficit_avg = htonl(deficit_avg); }
     void set_deficit(uint32_t deficit)    			        { _deficit = htonl(deficit); }
+    void set_queue_delay_ewma(uint32_t delay)               { _queue_delay_ewma = htonl(delay); }
+    void set_queue_delay_p50(uint32_t delay)                { _queue_delay_p50 = htonl(delay); }
+    void set_queue_delay_p95(uint32_t delay)                { _queue_delay_p95 = htonl(delay); }
+    void set_queue_delay_p99(uint32_t delay)                { _queue_delay_p99 = htonl(delay); }
+} CLICK_SIZE_PACKED_ATTRIBUTE;
+
+/* slice queue station entry format */
+struct slice_station_entry {
+  private:
+    uint8_t     _sta[6];            /* EtherAddress */
+    uint64_t    _tx_airtime;        /* Airtime used in usec (int) */
+    uint32_t    _tx_packets;        /* Int */
+    uint32_t    _tx_bytes;          /* Int */
+    int32_t     _deficit;           /* Airtime deficit in usec (int) */
+    uint32_t    _sojourn;           /* Sojourn time of the last frame in usec (int) */
+    uint32_t    _drops;             /* Frames dropped because the queue was full (int) */
+    uint32_t    _aqm_drops;         /* Frames dropped by CoDel (int) */
+  public:
+    void set_sta(EtherAddress sta)                  { memcpy(_sta, sta.data(), 6); }
+    void set_tx_airtime(uint64_t tx_airtime)        { _tx_airtime = htobe64(tx_airtime); }
+    void set_tx_packets(uint32_t tx_packets)        { _tx_packets = htonl(tx_packets); }
+    void set_tx_bytes(uint32_t tx_bytes)            { _tx_bytes = htonl(tx_bytes); }
+    void set_deficit(int32_t deficit)               { _deficit = htonl(deficit); }
+    void set_sojourn(uint32_t sojourn)              { _sojourn = htonl(sojourn); }
+    void set_drops(uint32_t drops)                  { _drops = htonl(drops); }
+    void set_aqm_drops(uint32_t aqm_drops)          { _aqm_drops = htonl(aqm_drops); }
 } CLICK_SIZE_PACKED_ATTRIBUTE;
 
 CLICK_ENDDECLS
@@ -36,7 +36,9 @@
 CLICK_DECLS
 
 EmpowerQOSManager::EmpowerQOSManager() :
-		_el(0), _el_queue_info(0), _rc(0), _sleepiness(0), _capacity(500), _quantum(1470), _iface_id(0), _debug(false) {
+		_el(0), _el_queue_info(0), _rc(0), _sleepiness(0), _capacity(500), _quantum(1470),
+		_codel_target(Timestamp::make_msec(0, 5)), _codel_interval(Timestamp::make_msec(0, 100)),
+		_iface_id(0), _debug(false) {
 }
 
 EmpowerQOSManager::~EmpowerQOSManager() {
@@ -51,6 +53,8 @@ int EmpowerQOSManager::configure(Vector<String> &conf,
 			.read_m("RC", ElementCastArg("Minstrel"), _rc)
 			.read_m("IFACE_ID", _iface_id)
 			.read("QUANTUM", _quantum)
+			.read("CODEL_TARGET", _codel_target)
+			.read("CODEL_INTERVAL", _codel_interval)
 			.read("DEBUG", _debug)
 			.complete();
 
@@ -80,6 +84,7 @@ EmpowerQOSManager::push(int, Packet *p) {
 
 	Timestamp now = Timestamp::now();
 	p->set_timestamp_anno(now);
+	SET_AIRTIME_ANNO(p, 0);
 
 	int dscp = 0;
 	uint8_t iface_id = PAINT_ANNO(p);
@@ -95,19 +100,13 @@ EmpowerQOSManager::push(int, Packet *p) {
 
 	// If traffic is unicast we need to check if the lvap is active
 	if (!dst.is_broadcast() && !dst.is_group()) {
-		EmpowerStationState *ess = _el->get_ess(dst);
-		if (!ess) {
+		const EmpowerStationView *esv = _el->get_station(dst);
+		if (!esv || !esv->is_valid(iface_id)) {
 			p->kill();
 			return;
 		}
-		_el->lock()->acquire_read();
-		if (!ess->is_valid(iface_id)){
-			p->kill();
-		} else {
-	        _el->get_txp(ess->_sta)->update_tx(p->length());
-	        store(ess->_ssid, dscp, p, dst, ess->_bssid);
-		}
-		_el->lock()->release_read();
+		esv->_txp->update_tx(p->length());
+		store(esv->_ssid, dscp, p, dst, esv->_bssid, esv->_max_amsdu_length);
 		return;
 	}
 
@@ -239,34 +238,30 @@ EmpowerQOSManager::push(int, Packet *p) {
 
 }
 
-void EmpowerQOSManager::store(String ssid, int dscp, Packet *q, EtherAddress ra, EtherAddress ta) {
+void EmpowerQOSManager::store(String ssid, int dscp, Packet *q, EtherAddress ra, EtherAddress ta, uint32_t max_amsdu_length) {
 
 	_lock.acquire_write();
 
-	Slice slice = Slice(ssid, dscp);
-	SliceQueue *sliceq = 0;
+	SliceQueue *sliceq = _slices.get(Slice(ssid, dscp));
+	bool crr_slice = (sliceq != 0);
 
-	if (_slices.find(slice) == _slices.end()) {
-		slice = Slice(ssid, 0);
-		assert(_slices.find(slice) != _slices.end());
+	if (!sliceq) {
+		sliceq = _slices.get(Slice(ssid, 0));
+		assert(sliceq);
 	}
 
-	sliceq = _slices.get(slice);
-
-	if (sliceq->enqueue(q, ra, ta)) {
+	if (sliceq->enqueue(q, ra, ta, max_amsdu_length)) {
 
         // Process packet enqueue for stats (@PHI)
-        Slice crr_slice = Slice(ssid, dscp);
-
-        if (_slices.find(crr_slice) != _slices.end()) {
+        if (crr_slice) {
             _el_queue_info->process_packet_enqueue(dscp, Timestamp::now());
         }
         // end (@PHI)
 
 		// check if queue was empty and no packet in buffer
-		if (sliceq->size() == 1 && _head_table.find(slice).value() == 0) {
+		if (!sliceq->_active) {
 			sliceq->_deficit = 0;
-			_active_list.push_back(slice);
+			_active_list.push_back(sliceq);
 		}
 		// wake up queue
 		_empty_note.wake();
@@ -291,36 +286,44 @@ Packet * EmpowerQOSManager::pull(int) {
 
 	_lock.acquire_write();
 
-	Slice slice = _active_list[0];
-	_active_list.pop_front();
+	SliceQueue* queue = _active_list.front();
 
-	SIter active = _slices.find(slice);
-	HItr head = _head_table.find(slice);
-	SliceQueue* queue = active.value();
+	if (!queue) {
+		_lock.release_write();
+		return 0;
+	}
 
 	Packet *p = 0;
-	if (head.value()) {
-		p = head.value();
-		_head_table.set(slice, 0);
+	if (queue->_head) {
+		p = queue->_head;
+		queue->_head = 0;
 	} else {
 		p = queue->dequeue();
 	}
 
+	// the estimate is cached on the packet by SliceQueue::dequeue
+	uint32_t deficit = p ? _rc->estimate_usecs_wifi_packet(p) : 0;
+
 	if (!p) {
 		queue->_deficit = 0;
-	} else if (_rc->estimate_usecs_wifi_packet(p) <= queue->_deficit) {
-		uint32_t deficit = _rc->estimate_usecs_wifi_packet(p);
+		_active_list.remove(queue);
+	} else if (deficit <= queue->_deficit) {
 		queue->_deficit -= deficit;
 		queue->_deficit_used += deficit;
 		queue->_tx_bytes += p->length();
-		queue->_tx_packets++;
+		queue->_tx_packets += queue->_crr_msdus;
 
 		// Process packet dequeue (@PHI)
-		_el_queue_info->process_packet_dequeue(queue->_slice._dscp, Timestamp::now());
+		_el_queue_info->process_packet_dequeue(queue->_slice._dscp, p->timestamp_anno(), Timestamp::now());
 
-		// Getting the current average delay for the slice (@PHI)
-        queue->_queue_delay_sec = _el_queue_info->get_queue_delay(queue->_slice._dscp).sec();
-        queue->_queue_delay_usec = _el_queue_info->get_queue_delay(queue->_slice._dscp).usec();
+		// Getting the current delay statistics for the slice (@PHI)
+		const QueueDelayStats *stats = _el_queue_info->get_stats(queue->_slice._dscp);
+        queue->_queue_delay_sec = stats->_delay_avg.sec();
+        queue->_queue_delay_usec = stats->_delay_avg.usec();
+        queue->_queue_delay_ewma = stats->ewma();
+        queue->_queue_delay_p50 = stats->_p50;
+        queue->_queue_delay_p95 = stats->_p95;
+        queue->_queue_delay_p99 = stats->_p99;
 
         // Process packet dequeue (@PHI)
         _el_queue_info->process_packet_deficit(queue->_slice._dscp, deficit);
@@ -328,14 +331,14 @@ Packet * EmpowerQOSManager::pull(int) {
         // Getting the current average deficit for the slice (@PHI)
         queue->_deficit_avg = _el_queue_info->get_deficit(queue->_slice._dscp);
 
-        if (queue->size() > 0) {
-			_active_list.push_front(slice);
+        if (queue->size() == 0) {
+			_active_list.remove(queue);
 		}
 		_lock.release_write();
 		return p;
 	} else {
-		_head_table.set(slice, p);
-		_active_list.push_back(slice);
+		queue->_head = p;
+		_active_list.rotate();
 		queue->_deficit += queue->_quantum;
 	}
 
@@ -345,10 +348,18 @@ Packet * EmpowerQOSManager::pull(int) {
 }
 
 void EmpowerQOSManager::set_default_slice(String ssid) {
-	set_slice(ssid, 0, 12000, false, 0);
+	set_slice(ssid, 0, 12000, false, 0, 0);
+}
+
+void EmpowerQOSManager::set_aqm(SliceQueue *queue, uint32_t aqm) {
+	// FQ only applies to station queues created after the change
+	queue->_codel._enabled = (aqm == EMPOWER_AQM_CODEL || aqm == EMPOWER_AQM_FQ_CODEL);
+	queue->_codel._fq = (aqm == EMPOWER_AQM_FQ_CODEL);
+	queue->_codel._target = _codel_target.usecval();
+	queue->_codel._interval = _codel_interval.usecval();
 }
 
-void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool amsdu_aggregation, uint32_t scheduler) {
+void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool amsdu_aggregation, uint32_t scheduler, uint32_t aqm) {
 
 	_lock.acquire_write();
 
@@ -357,36 +368,39 @@ void EmpowerQOSManager::set_slice(String ssid, int dscp, uint32_t quantum, bool
 
 	if (itr == _slices.end()) {
 		if (_debug) {
-			click_chatter("%{element} :: %s :: Creating new slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u",
+			click_chatter("%{element} :: %s :: Creating new slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u AQM %u",
 						  this,
 						  __func__,
 						  slice._ssid.c_str(),
 						  slice._dscp,
 						  quantum,
 						  amsdu_aggregation ? "yes" : "no",
-						  scheduler);
+						  scheduler,
+						  aqm);
 		}
 
 		uint32_t tr_quantum = (quantum == 0) ? _quantum : quantum;
-		SliceQueue *queue = new SliceQueue(slice, _capacity, tr_quantum, amsdu_aggregation, scheduler);
+		SliceQueue *queue = new SliceQueue(slice, _capacity, tr_quantum, amsdu_aggregation, scheduler, _rc);
+		set_aqm(queue, aqm);
 		_slices.set(slice, queue);
-		_head_table.set(slice, 0);
 	} else {
 		if (_debug) {
-			click_chatter("%{element} :: %s :: Updating slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u",
+			click_chatter("%{element} :: %s :: Updating slice queue for ssid %s dscp %u quantum %u A-MSDU %s scheduler %u AQM %u",
 						  this,
 						  __func__,
 						  slice._ssid.c_str(),
 						  slice._dscp,
 						  quantum,
 						  amsdu_aggregation ? "yes" : "no",
-						  scheduler);
+						  scheduler,
+						  aqm);
 		}
 
 		SliceQueue* queue = itr.value();
 		queue->_quantum = quantum;
 		queue->_amsdu_aggregation = amsdu_aggregation;
 		queue->_scheduler = scheduler;
+		set_aqm(queue, aqm);
 	}
 
 	_el->send_status_slice(ssid, dscp, _iface_id);
@@ -406,34 +420,18 @@ void EmpowerQOSManager::del_slice(String ssid, int dscp) {
 					  dscp);
 	}
 
-	// remove from active list
-	Vector<Slice>::iterator it = _active_list.begin();
-	while (it != _active_list.end()) {
-		if (it->_ssid == ssid && it->_dscp == dscp) {
-			it = _active_list.erase(it);
-			break;
-		}
-		it++;
-	}
-
 	Slice slice = Slice(ssid, dscp);
 
 	// remove slice
 	SIter itr = _slices.find(slice);
 	if (itr == _slices.end()) {
+		_lock.release_write();
 		return;
 	}
 	SliceQueue *sliceq = itr.value();
-	delete sliceq;
+	_active_list.remove(sliceq);
 	_slices.erase(itr);
-
-	// remove from head table
-	HItr itr2 = _head_table.find(slice);
-	Packet *p = itr2.value();
-	if (p){
-		p->kill();
-	}
-	_head_table.erase(itr2);
+	delete sliceq;
 
 	_lock.release_write();
 
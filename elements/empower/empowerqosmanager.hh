@@ -10,9 +10,15 @@
 #include <click/hashmap.hh>
 #include <click/hashtable.hh>
 #include <click/straccum.hh>
+#include <click/machine.hh>
+#include <click/integers.hh>
+#include <click/timestamp.hh>
 #include <clicknet/wifi.h>
 #include <clicknet/llc.h>
+#include <clicknet/ip.h>
 #include <elements/standard/simplequeue.hh>
+#include <elements/wifi/minstrel.hh>
+#include "empowerlvapmanager.hh"
 CLICK_DECLS
 
 /*
@@ -30,13 +36,34 @@ Also maintains a dedicated queue for each pair tenant/dscp.
 =d
 
 Strips the Ethernet header off the front of the packet and pushes
-an 802.11 frame header and LLC header onto the packet.
+an 802.11 frame header and LLC header onto the packet. Slices with A-MSDU
+aggregation enabled pack consecutive frames for the same HT station into a
+single A-MSDU, up to the maximum A-MSDU length advertised in the HT
+capabilities of its association request (3839 or 7935 bytes). Frames for
+non-HT stations and group addresses are always sent one by one.
+
+Within a slice stations are served in round robin, one frame per turn.
+Slices using the airtime fairness scheduler instead run a deficit round
+robin over the stations where deficits are in microseconds of airtime,
+as estimated by Minstrel for the current rate, so that slow stations do
+not take airtime away from fast ones.
+
+Slices can also run CoDel on the queue of each station, using the time
+at which the frame entered the element as its enqueue time. With FQ-CoDel
+the frames of a station are hashed by 5-tuple into 8 sub-queues served in
+deficit round robin, each with its own CoDel state.
 
 Arguments are:
 
 =item EL
 An EmpowerLVAPManager element
 
+=item CODEL_TARGET
+Target sojourn time of slices using CoDel. Default is 5 ms.
+
+=item CODEL_INTERVAL
+CoDel interval of slices using CoDel. Default is 100 ms.
+
 =item DEBUG
 Turn debug on/off
 
@@ -80,105 +107,415 @@ class EtherPair {
 
 };
 
+/*
+ * Intrusive ring of active queues used by the DRR schedulers. Elements
+ * carry their own links and an active bit, so that activation, removal
+ * and rotation are all O(1).
+ */
+template <typename T>
+class DRRRing {
+public:
+
+	DRRRing() : _head(0), _size(0) {
+	}
+
+	bool empty() const { return _head == 0; }
+	uint32_t size() const { return _size; }
+	T *front() const { return _head; }
+
+	void push_back(T *t) {
+		if (t->_active) {
+			return;
+		}
+		if (!_head) {
+			t->_next = t->_prev = t;
+			_head = t;
+		} else {
+			t->_next = _head;
+			t->_prev = _head->_prev;
+			_head->_prev->_next = t;
+			_head->_prev = t;
+		}
+		t->_active = true;
+		_size++;
+	}
+
+	void remove(T *t) {
+		if (!t->_active) {
+			return;
+		}
+		if (t->_next == t) {
+			_head = 0;
+		} else {
+			t->_prev->_next = t->_next;
+			t->_next->_prev = t->_prev;
+			if (_head == t) {
+				_head = t->_next;
+			}
+		}
+		t->_next = t->_prev = 0;
+		t->_active = false;
+		_size--;
+	}
+
+	// move the head to the back of the ring
+	void rotate() {
+		if (_head) {
+			_head = _head->_next;
+		}
+	}
+
+private:
+
+	T *_head;
+	uint32_t _size;
+
+};
+
+/*
+ * Single producer, single consumer ring of frames. The ring size is a
+ * power of two and the free running head (consumer) and tail (producer)
+ * indexes sit on separate cache lines, so enqueue and dequeue do not need
+ * a lock.
+ */
+class FrameRing {
+
+public:
+
+	FrameRing() : _q(0), _size(0), _mask(0), _head(0), _tail(0) {
+	}
+
+	~FrameRing() {
+		for (uint32_t i = _head; i != _tail; i++) {
+			_q[i & _mask]->kill();
+		}
+		delete[] _q;
+	}
+
+	void init(uint32_t capacity) {
+		_size = 1;
+		while (_size < capacity) {
+			_size <<= 1;
+		}
+		_mask = _size - 1;
+		_q = new Packet*[_size];
+	}
+
+	// consumer side
+	Packet* pull() {
+		uint32_t h = _head;
+		if (h == _tail) {
+			return 0;
+		}
+		// do not read the slot before the producer's tail
+		click_read_fence();
+		Packet *p = _q[h & _mask];
+		// the slot must be read before the producer can reuse it
+		click_read_fence();
+		_head = h + 1;
+		return p;
+	}
+
+	// producer side, the caller checks the capacity
+	void push(Packet* p) {
+		uint32_t t = _tail;
+		_q[t & _mask] = p;
+		click_write_fence();
+		_tail = t + 1;
+	}
+
+	// consumer side
+	const Packet* top() {
+		uint32_t h = _head;
+		if (h == _tail) {
+			return 0;
+		}
+		click_read_fence();
+		return _q[h & _mask];
+	}
+
+	uint32_t size() { return _tail - _head; }
+
+private:
+
+	Packet** _q;
+	uint32_t _size;
+	uint32_t _mask;
+	char _pad0[CLICK_CACHE_LINE_SIZE];
+	volatile uint32_t _head; // consumer index
+	char _pad1[CLICK_CACHE_LINE_SIZE - sizeof(uint32_t)];
+	volatile uint32_t _tail; // producer index
+
+};
+
+/*
+ * CoDel settings shared by all the station queues of a slice.
+ */
+class CoDelParams {
+public:
+
+	bool _enabled;
+	bool _fq;
+	uint32_t _target; // in usec
+	uint32_t _interval; // in usec
+
+	CoDelParams() : _enabled(false), _fq(false), _target(5000), _interval(100000) {
+	}
+
+};
+
+/*
+ * CoDel (RFC 8289) state machine, evaluated once on each frame that
+ * reaches the head of a queue.
+ */
+class CoDelState {
+public:
+
+	Timestamp _first_above_time;
+	Timestamp _drop_next;
+	uint32_t _count;
+	uint32_t _last_count;
+	bool _dropping;
+
+	CoDelState() : _count(0), _last_count(0), _dropping(false) {
+	}
+
+	Timestamp control_law(Timestamp t, uint32_t interval) {
+		uint64_t usec = (uint64_t) interval * 1024 / int_sqrt((uint64_t) _count << 20);
+		return t + Timestamp::make_usec(usec);
+	}
+
+	// returns true if the head frame p must be dropped
+	bool drop(const Packet *p, Timestamp now, const CoDelParams *params, bool backlog) {
+
+		Timestamp interval = Timestamp::make_usec(params->_interval);
+		Timestamp sojourn = now - p->timestamp_anno();
+		bool ok_to_drop = false;
+
+		if (sojourn.usecval() < params->_target || !backlog) {
+			_first_above_time = Timestamp();
+		} else if (!_first_above_time) {
+			_first_above_time = now + interval;
+		} else if (now >= _first_above_time) {
+			ok_to_drop = true;
+		}
+
+		if (_dropping) {
+			if (!ok_to_drop) {
+				_dropping = false;
+				return false;
+			}
+			if (now >= _drop_next) {
+				_count++;
+				_drop_next = control_law(_drop_next, params->_interval);
+				return true;
+			}
+			return false;
+		}
+
+		if (ok_to_drop) {
+			// re-enter the dropping state close to the previous drop rate
+			uint32_t delta = _count - _last_count;
+			_count = (delta > 1 && now - _drop_next < interval * 16) ? delta : 1;
+			_last_count = _count;
+			_drop_next = control_law(now, params->_interval);
+			_dropping = true;
+			return true;
+		}
+
+		return false;
+
+	}
+
+};
+
+/*
+ * Frames for one RA/TA pair. With FQ-CoDel enabled the frames are further
+ * hashed by 5-tuple into FQ_FLOWS sub-queues served in deficit round
+ * robin, each with its own CoDel state. The producer only touches the
+ * tail of the rings, all the scheduling and dropping happens on the
+ * consumer side.
+ */
 class AggregationQueue {
 
 public:
-	uint32_t _quantum;
 
-	AggregationQueue(uint32_t capacity, EtherPair pair) {
-		_q = new Packet*[capacity];
+	enum { FQ_FLOWS = 8, FQ_QUANTUM = 1514 };
+
+	uint32_t _quantum;
+	AggregationQueue *_next;
+	AggregationQueue *_prev;
+	bool _active;
+	int32_t _deficit; // airtime deficit in usec (airtime fairness)
+	uint64_t _tx_airtime; // in usec
+	uint32_t _tx_packets;
+	uint32_t _tx_bytes;
+	uint32_t _sojourn; // sojourn time of the last dequeued frame in usec
+	uint32_t _aqm_drops;
+	uint32_t _max_amsdu_length; // 0 if the station cannot receive A-MSDUs
+
+	AggregationQueue(uint32_t capacity, EtherPair pair, const CoDelParams *params) {
+		_params = params;
+		_nb_flows = params->_fq ? FQ_FLOWS : 1;
+		_flows = new Flow[_nb_flows];
+		for (uint32_t i = 0; i < _nb_flows; i++) {
+			_flows[i]._ring.init(capacity);
+		}
+		_crr_flow = 0;
+		_next = 0;
+		_prev = 0;
+		_active = false;
 		_deficit = 0;
 		_quantum = 0;
+		_tx_airtime = 0;
+		_tx_packets = 0;
+		_tx_bytes = 0;
+		_sojourn = 0;
+		_aqm_drops = 0;
+		_max_amsdu_length = 0;
 		_capacity = capacity;
 		_pair = pair;
-		_nb_pkts = 0;
 		_drops = 0;
-		_head = 0;
-		_tail = 0;
-		for (unsigned i = 0; i < _capacity; i++) {
-			_q[i] = 0;
-		}
 	}
 
 	String unparse() {
 		StringAccum result;
-		_queue_lock.acquire_read();
-		result << _pair.unparse() << " -> status: " << _nb_pkts << "/" << _capacity << "\n";
-		_queue_lock.release_read();
+		result << _pair.unparse() << " -> status: " << nb_pkts() << "/" << _capacity;
+		result << ", drops: " << _drops;
+		if (_params->_enabled) {
+			result << ", aqm drops: " << _aqm_drops << ", sojourn: " << _sojourn;
+		}
+		result << ", deficit: " << _deficit << ", airtime: " << _tx_airtime << "\n";
 		return result.take_string();
 	}
 
 	~AggregationQueue() {
-		_queue_lock.acquire_write();
-		for (uint32_t i = 0; i < _capacity; i++) {
-			if (_q[i]) {
-				_q[i]->kill();
-			}
-		}
-		delete[] _q;
-		_queue_lock.release_write();
+		delete[] _flows;
 	}
 
 	Packet* pull() {
-		Packet* p = 0;
-		_queue_lock.acquire_write();
-		if (_nb_pkts > 0) {
-			p = _q[_head];
-			_q[_head] = 0;
-			_head++;
-			_head %= _capacity;
-			_nb_pkts--;
-		}
-		_queue_lock.release_write();
+		Flow *flow = select_flow();
+		if (!flow) {
+			return 0;
+		}
+		Packet *p = flow->_ring.pull();
+		flow->_checked = false;
+		flow->_deficit -= p->length();
+		_sojourn = (Timestamp::now() - p->timestamp_anno()).usecval();
 		return p;
 	}
 
 	bool push(Packet* p) {
-		bool result = false;
-		_queue_lock.acquire_write();
-		if (_nb_pkts == _capacity) {
+		if (nb_pkts() >= _capacity) {
 			_drops++;
-			result = false;
-		} else {
-			_q[_tail] = p;
-			_tail++;
-			_tail %= _capacity;
-			_nb_pkts++;
-			result = true;
-		}
-		_queue_lock.release_write();
-		return result;
+			return false;
+		}
+		_flows[flow_hash(p)]._ring.push(p);
+		return true;
 	}
 
-    const Packet* top() {
-      Packet* p = 0;
-      _queue_lock.acquire_write();
-      if(_head != _tail) {
-        p = _q[(_head+1) % _capacity];
-      }
-      _queue_lock.release_write();
-      return p;
-    }
+	// the frame that the next pull() will return
+	const Packet* top() {
+		Flow *flow = select_flow();
+		return flow ? flow->_ring.top() : 0;
+	}
 
 	uint32_t top_length() {
-		return top()->length();
+		const Packet *p = top();
+		return p ? p->length() : 0;
 	}
 
-    uint32_t nb_pkts() { return _nb_pkts; }
-    EtherPair pair() { return _pair; }
+	uint32_t nb_pkts() {
+		uint32_t nb_pkts = 0;
+		for (uint32_t i = 0; i < _nb_flows; i++) {
+			nb_pkts += _flows[i]._ring.size();
+		}
+		return nb_pkts;
+	}
+
+	uint32_t drops() { return _drops; }
+	EtherPair pair() { return _pair; }
 
 private:
 
-	ReadWriteLock _queue_lock;
-	Packet** _q;
+	class Flow {
+	public:
+		FrameRing _ring;
+		CoDelState _codel;
+		int32_t _deficit;
+		bool _checked; // head frame already went through CoDel
+		Flow() : _deficit(0), _checked(false) {
+		}
+	};
+
+	Flow *_flows;
+	uint32_t _nb_flows;
+	uint32_t _crr_flow;
+	const CoDelParams *_params;
 
 	uint32_t _capacity;
-	uint32_t _deficit;
 	EtherPair _pair;
-	uint32_t _nb_pkts;
 	uint32_t _drops;
-	uint32_t _head;
-	uint32_t _tail;
+
+	uint32_t flow_hash(Packet *p) {
+		if (_nb_flows == 1) {
+			return 0;
+		}
+		const click_ether *eh = (const click_ether *) p->data();
+		if (eh->ether_type != htons(ETHERTYPE_IP) || !p->has_network_header()) {
+			return 0;
+		}
+		const click_ip *ip = p->ip_header();
+		uint32_t hash = ip->ip_src.s_addr ^ ip->ip_dst.s_addr ^ ip->ip_p;
+		if ((ip->ip_p == IP_PROTO_TCP || ip->ip_p == IP_PROTO_UDP) && !IP_ISFRAG(ip)
+				&& p->transport_header() + 4 <= p->end_data()) {
+			uint32_t ports;
+			memcpy(&ports, p->transport_header(), 4);
+			hash ^= ports;
+		}
+		hash ^= hash >> 16;
+		hash *= 0x45d9f3b;
+		hash ^= hash >> 16;
+		return hash & (_nb_flows - 1);
+	}
+
+	// head frame of a flow after CoDel dropped what it had to
+	const Packet *head(Flow *flow) {
+		const Packet *p;
+		while ((p = flow->_ring.top())) {
+			if (!_params->_enabled || flow->_checked) {
+				return p;
+			}
+			if (!flow->_codel.drop(p, Timestamp::now(), _params, flow->_ring.size() > 1)) {
+				flow->_checked = true;
+				return p;
+			}
+			flow->_ring.pull()->kill();
+			_aqm_drops++;
+		}
+		return 0;
+	}
+
+	Flow *select_flow() {
+		if (_nb_flows == 1) {
+			return head(&_flows[0]) ? &_flows[0] : 0;
+		}
+		while (nb_pkts() > 0) {
+			Flow *flow = &_flows[_crr_flow];
+			if (!head(flow)) {
+				flow->_deficit = 0;
+				_crr_flow = (_crr_flow + 1) & (_nb_flows - 1);
+				continue;
+			}
+			if (flow->_deficit <= 0) {
+				flow->_deficit += FQ_QUANTUM;
+				_crr_flow = (_crr_flow + 1) & (_nb_flows - 1);
+				continue;
+			}
+			return flow;
+		}
+		return 0;
+	}
 
 };
 
@@ -221,8 +558,15 @@ class SliceQueue {
 
 public:
 
+	// per station airtime quantum (in usec) used by the airtime fairness scheduler
+	enum { AIRTIME_QUANTUM = 300 };
+
     AggregationQueues _queues;
-	Vector<EtherPair> _active_list;
+	DRRRing<AggregationQueue> _active_list;
+	SliceQueue *_next;
+	SliceQueue *_prev;
+	bool _active;
+	Packet *_head; // frame waiting for enough deficit
 
 	Slice _slice;
     uint32_t _capacity;
@@ -231,7 +575,6 @@ public:
     uint32_t _deficit;
     uint32_t _quantum;
     bool _amsdu_aggregation;
-    uint32_t _max_aggr_length;
     uint32_t _deficit_used;
     uint32_t _max_queue_length;
     uint32_t _crr_queue_length;
@@ -240,16 +583,29 @@ public:
     uint32_t _scheduler;
     uint32_t _queue_delay_sec; // in sec
     uint32_t _queue_delay_usec; // in usec
+    uint32_t _queue_delay_ewma; // in usec
+    uint32_t _queue_delay_p50; // in usec
+    uint32_t _queue_delay_p95; // in usec
+    uint32_t _queue_delay_p99; // in usec
     uint32_t _deficit_avg;
-
-    SliceQueue(Slice slice, uint32_t capacity, uint32_t quantum, bool amsdu_aggregation, uint32_t scheduler) :
-			_slice(slice), _capacity(capacity), _size(0), _drops(0), _deficit(0), _quantum(quantum),
-			_amsdu_aggregation(amsdu_aggregation), _max_aggr_length(7935),_deficit_used(0), _max_queue_length(0),
+    uint32_t _crr_msdus; // msdus carried by the last dequeued frame
+    uint32_t _amsdu_frames;
+    uint32_t _amsdu_msdus;
+    uint32_t _aqm_drops;
+    CoDelParams _codel;
+    Minstrel *_rc;
+
+    SliceQueue(Slice slice, uint32_t capacity, uint32_t quantum, bool amsdu_aggregation, uint32_t scheduler, Minstrel *rc) :
+			_next(0), _prev(0), _active(false), _head(0), _slice(slice), _capacity(capacity), _size(0), _drops(0), _deficit(0), _quantum(quantum),
+			_amsdu_aggregation(amsdu_aggregation), _deficit_used(0), _max_queue_length(0),
 			_crr_queue_length(0), _tx_packets(0), _tx_bytes(0), _scheduler(scheduler), _queue_delay_sec(0),
-			_queue_delay_usec(0), _deficit_avg(0) {
+			_queue_delay_usec(0), _queue_delay_ewma(0), _queue_delay_p50(0), _queue_delay_p95(0), _queue_delay_p99(0), _deficit_avg(0), _crr_msdus(0), _amsdu_frames(0), _amsdu_msdus(0), _aqm_drops(0), _rc(rc) {
 	}
 
 	~SliceQueue() {
+		if (_head) {
+			_head->kill();
+		}
 		AQIter itr = _queues.begin();
 		while (itr != _queues.end()) {
 			AggregationQueue *aq = itr.value();
@@ -308,22 +664,98 @@ public:
 
     }
 
-    bool enqueue(Packet *p, EtherAddress ra, EtherAddress ta) {
+    // length of the A-MSDU subframe carrying the ethernet frame p (without padding)
+    static uint32_t amsdu_subframe_length(const Packet *p) {
+		return sizeof(click_ether) + WIFI_LLC_HEADER_LEN + p->length() - sizeof(click_ether);
+    }
+
+    Packet * wifi_amsdu_encap(Vector<Packet *> &msdus, uint32_t length, EtherAddress ra, EtherAddress ta) {
+
+		uint32_t hdr_len = sizeof(struct click_wifi) + sizeof(struct click_qos_control);
+		WritablePacket *q = Packet::make(Packet::default_headroom, 0, hdr_len + length, 0);
+
+		if (!q) {
+			for (int i = 0; i < msdus.size(); i++) {
+				msdus[i]->kill();
+			}
+			return 0;
+		}
+
+		q->copy_annotations(msdus[0]);
+
+		struct click_wifi *w = (struct click_wifi *) q->data();
+
+		memset(q->data(), 0, hdr_len);
+
+		w->i_fc[0] = (uint8_t) (WIFI_FC0_VERSION_0 | WIFI_FC0_TYPE_DATA | WIFI_FC0_SUBTYPE_QOS);
+		w->i_fc[1] = (uint8_t) (WIFI_FC1_DIR_MASK & WIFI_FC1_DIR_FROMDS);
+
+		// in an A-MSDU the DA/SA are carried by each subframe, addr3 is the BSSID
+		memcpy(w->i_addr1, ra.data(), 6);
+		memcpy(w->i_addr2, ta.data(), 6);
+		memcpy(w->i_addr3, ta.data(), 6);
+
+		// TID 0 (best effort), A-MSDU present
+		struct click_qos_control *qos = (struct click_qos_control *) (q->data() + sizeof(struct click_wifi));
+		qos->qos_control = cpu_to_le16(WIFI_QOS_CONTROL);
+
+		uint8_t *ptr = q->data() + hdr_len;
+
+		for (int i = 0; i < msdus.size(); i++) {
+
+			Packet *p = msdus[i];
+			click_ether *eh = (click_ether *) p->data();
+			uint16_t payload = WIFI_LLC_HEADER_LEN + p->length() - sizeof(click_ether);
+
+			// subframe header: DA, SA, length (big endian)
+			memcpy(ptr, eh->ether_dhost, 6);
+			memcpy(ptr + 6, eh->ether_shost, 6);
+			*(uint16_t *) (ptr + 12) = htons(payload);
+			ptr += sizeof(click_ether);
+
+			memcpy(ptr, WIFI_LLC_HEADER, WIFI_LLC_HEADER_LEN);
+			memcpy(ptr + 6, &eh->ether_type, 2);
+			ptr += WIFI_LLC_HEADER_LEN;
+
+			memcpy(ptr, p->data() + sizeof(click_ether), p->length() - sizeof(click_ether));
+			ptr += p->length() - sizeof(click_ether);
+
+			// every subframe but the last is padded to a multiple of 4 bytes
+			if (i < msdus.size() - 1) {
+				uint32_t pad = (4 - ((sizeof(click_ether) + payload) & 3)) & 3;
+				memset(ptr, 0, pad);
+				ptr += pad;
+			}
+
+			p->kill();
+
+		}
+
+		return q;
+
+    }
+
+    bool enqueue(Packet *p, EtherAddress ra, EtherAddress ta, uint32_t max_amsdu_length) {
 
     	EtherPair pair = EtherPair(ra, ta);
 
-		if (_queues.find(pair) == _queues.end()) {
-			AggregationQueue *queue = new AggregationQueue(_capacity, pair);
+		AggregationQueue *queue = _queues.get(pair);
+
+		if (!queue) {
+			queue = new AggregationQueue(_capacity, pair, &_codel);
 			_queues.set(pair, queue);
-			_active_list.push_back(pair);
 		}
 
-		AggregationQueue *queue = _queues.get(pair);
+		// the station may have reassociated with different capabilities
+		queue->_max_amsdu_length = max_amsdu_length;
 
 		if (queue->push(p)) {
-			// check if ra is in active list
-			if (find(_active_list.begin(), _active_list.end(), pair) == _active_list.end()) {
-				_active_list.push_back(pair);
+			if (!queue->_active) {
+				// do not let idle stations accumulate airtime credit
+				if (queue->_deficit > AIRTIME_QUANTUM) {
+					queue->_deficit = AIRTIME_QUANTUM;
+				}
+				_active_list.push_back(queue);
 			}
 			if (queue->nb_pkts() > _max_queue_length) {
 				_max_queue_length = queue->nb_pkts();
@@ -341,30 +773,105 @@ public:
 
     Packet *dequeue() {
 
-		if (_active_list.empty()) {
-			return 0;
+		while (!_active_list.empty()) {
+
+			AggregationQueue *queue = _active_list.front();
+
+			if (queue->nb_pkts() == 0) {
+				_active_list.remove(queue);
+				continue;
+			}
+
+			if (_scheduler == EMPOWER_AIRTIME_FAIRNESS) {
+				// stations are served until they run out of airtime, then
+				// they get a new quantum and move to the end of the round
+				if (queue->_deficit <= 0) {
+					queue->_deficit += AIRTIME_QUANTUM;
+					_active_list.rotate();
+					continue;
+				}
+			} else {
+				_active_list.rotate();
+			}
+
+			Packet *p = dequeue(queue);
+
+			if (!p) {
+				continue;
+			}
+
+			uint32_t airtime = _rc->estimate_usecs_wifi_packet(p);
+			if (_scheduler == EMPOWER_AIRTIME_FAIRNESS) {
+				queue->_deficit -= airtime;
+			}
+			queue->_tx_airtime += airtime;
+			queue->_tx_packets += _crr_msdus;
+			queue->_tx_bytes += p->length();
+
+			return p;
+
 		}
 
-		EtherPair pair = _active_list[0];
-		_active_list.pop_front();
+		return 0;
+
+    }
+
+    Packet *dequeue(AggregationQueue *queue) {
+
+		// frames dropped by CoDel leave the slice too
+		uint32_t aqm_drops = queue->_aqm_drops;
+		Packet *p = aggregate(queue);
+		_size -= queue->_aqm_drops - aqm_drops;
+		_aqm_drops += queue->_aqm_drops - aqm_drops;
+
+		return p;
+
+    }
+
+    Packet *aggregate(AggregationQueue *queue) {
 
-		AQIter active = _queues.find(pair);
-		AggregationQueue* queue = active.value();
 		Packet *p = queue->pull();
 
 		if (!p) {
-			return dequeue();
+			return 0;
 		}
 
 		_size--;
+		_crr_msdus = 1;
+
+		EtherPair qpair = queue->pair();
+
+		if (_amsdu_aggregation && queue->_max_amsdu_length && queue->nb_pkts() > 0) {
+
+			// pack consecutive frames for the same RA/TA into a single A-MSDU
+			// no longer than the station can receive
+			Vector<Packet *> msdus;
+			msdus.push_back(p);
+			uint32_t length = amsdu_subframe_length(p);
+
+			const Packet *next;
+			while ((next = queue->top())) {
+				uint32_t padded = (length + 3) & ~3;
+				if (padded + amsdu_subframe_length(next) > queue->_max_amsdu_length) {
+					break;
+				}
+				msdus.push_back(queue->pull());
+				length = padded + amsdu_subframe_length(next);
+				_size--;
+			}
 
-		click_ether *eh = (click_ether *) p->data();
-		EtherAddress src = EtherAddress(eh->ether_shost);
-		p = wifi_encap(p, queue->pair()._ra, src, queue->pair()._ta);
+			if (msdus.size() > 1) {
+				_crr_msdus = msdus.size();
+				_amsdu_frames++;
+				_amsdu_msdus += msdus.size();
+				return wifi_amsdu_encap(msdus, length, qpair._ra, qpair._ta);
+			}
 
-		_active_list.push_back(pair);
+		}
 
-		return p;
+		click_ether *eh = (click_ether *) p->data();
+		EtherAddress src = EtherAddress(eh->ether_shost);
+		return wifi_encap(p, qpair._ra, src, qpair._ta);
 
     }
 
@@ -372,7 +879,18 @@ public:
 		StringAccum result;
 		result << _slice.unparse();
 		result << " -> capacity: " << _capacity << ", ";
-		result << "quantum: " << _quantum << "\n";
+		result << "quantum: " << _quantum << ", ";
+		result << "scheduler: " << (_scheduler == EMPOWER_AIRTIME_FAIRNESS ? "airtime fairness" : "round robin") << ", ";
+		result << "AQM: " << (_codel._enabled ? (_codel._fq ? "fq-codel" : "codel") : "none");
+		if (_codel._enabled) {
+			result << " (" << _aqm_drops << " drops)";
+		}
+		result << ", ";
+		result << "A-MSDU: " << (_amsdu_aggregation ? "yes" : "no");
+		if (_amsdu_aggregation) {
+			result << " (" << _amsdu_frames << " frames, " << _amsdu_msdus << " msdus)";
+		}
+		result << "\n";
 		AQIter itr = _queues.begin();
 		while (itr != _queues.end()) {
 			AggregationQueue *aq = itr.value();
@@ -387,9 +905,6 @@ public:
 typedef HashTable<Slice, SliceQueue*> Slices;
 typedef Slices::iterator SIter;
 
-typedef HashTable<Slice, Packet*> HeadTable;
-typedef HeadTable::iterator HItr;
-
 class EmpowerQOSManager: public Element {
 
 public:
@@ -409,10 +924,11 @@ public:
 
 	void add_handlers();
 	void set_default_slice(String);
-	void set_slice(String, int, uint32_t, bool, uint32_t);
+	void set_slice(String, int, uint32_t, bool, uint32_t, uint32_t);
 	void del_slice(String, int);
 
 	Slices * slices() { return &_slices; }
+	ReadWriteLock * lock() { return &_lock; }
 
 private:
 
@@ -426,18 +942,20 @@ private:
 	class Minstrel * _rc;
 
 	Slices _slices;
-    HeadTable _head_table;
-	Vector<Slice> _active_list;
+	DRRRing<SliceQueue> _active_list;
 
     int _sleepiness;
     uint32_t _capacity;
     uint32_t _quantum;
+    Timestamp _codel_target;
+    Timestamp _codel_interval;
 
     int _iface_id;
 
     bool _debug;
 
-	void store(String, int, Packet *, EtherAddress, EtherAddress);
+	void store(String, int, Packet *, EtherAddress, EtherAddress, uint32_t = 0);
+	void set_aqm(SliceQueue *, uint32_t);
 	String list_slices();
 
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
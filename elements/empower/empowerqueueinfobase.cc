@@ -19,12 +19,13 @@
 #include <click/config.h>
 #include <click/args.hh>
 #include <click/error.hh>
+#include <click/straccum.hh>
 #include "empowerqueueinfobase.hh"
 CLICK_DECLS
 
 
 EmpowerQueueInfoBase::EmpowerQueueInfoBase() :
-        _el(0), _timer(this), _period(500), _debug(false) {
+        _el(0), _debug(false), _period(500), _timer(this) {
 }
 
 EmpowerQueueInfoBase::~EmpowerQueueInfoBase() {
@@ -47,54 +48,9 @@ int EmpowerQueueInfoBase::configure(Vector<String> &conf,
 
 void EmpowerQueueInfoBase::run_timer(Timer *){
 
-    // Computing the average queue delay
-    for (DSCPDelayPacketsMap::iterator i = dscp_delay_packets_map.begin(); i!= dscp_delay_packets_map.end(); i++) {
-
-        Timestamp sum = Timestamp();
-        Timestamp avg = Timestamp();
-
-        // Iterate over the vector of computed delays
-        for (Vector<Timestamp>::const_iterator j = i.value().begin(); j!= i.value().end(); j++) {
-            sum += *j;
-        }
-
-        // If there was sum
-        if (sum){
-            avg = sum / i.value().size();
-        }
-
-        // Update the avg delay
-        dscp_queue_delay_map.insert(i.key(), avg);
-    }
-
-    // Reset delay packets map
-    for (DSCPDelayPacketsMap::iterator i = dscp_delay_packets_map.begin(); i!= dscp_delay_packets_map.end(); i++) {
-        i.value().clear();
-    }
-
-    // Computing the average deficit
-    for (DSCPDeficitPacketsMap::iterator i = dscp_deficit_packets_map.begin(); i!= dscp_deficit_packets_map.end(); i++) {
-
-        uint32_t sum = 0;
-        uint32_t avg = 0;
-
-        // Iterate over the vector of computed deficits
-        for (Vector<uint32_t>::const_iterator j = i.value().begin(); j!= i.value().end(); j++) {
-            sum += *j;
-        }
-
-        // If there was sum
-        if (sum){
-            avg = sum / i.value().size();
-        }
-
-        // Update the avg delay
-        dscp_deficit_map.insert(i.key(), avg);
-    }
-
-    // Reset deficit packets map
-    for (DSCPDeficitPacketsMap::iterator i = dscp_deficit_packets_map.begin(); i!= dscp_deficit_packets_map.end(); i++) {
-        i.value().clear();
+    // Computing the average queue delay, percentiles and average deficit
+    for (int i = 0; i < 64; i++) {
+        _stats[i].update();
     }
 
     _timer.schedule_after_msec(_period);
@@ -110,49 +66,12 @@ void EmpowerQueueInfoBase::process_packet_deficit(int dscp, int deficit) {
                       deficit);
     }
 
-    DSCPDeficitPacketsMap :: Pair * crr_dscp_deficit_pkts_pair = dscp_deficit_packets_map.find_pair(dscp);
-
-    // if DSCP exists in deficit packets map
-    if (crr_dscp_deficit_pkts_pair){
-        if (_debug){
-            click_chatter("%{element} :: %s :: Deficit packets vector size is: %d",
-                          this,
-                          __func__,
-                          crr_dscp_deficit_pkts_pair->value.size());
-        }
-
-        // Include packet timestamp at the end of the vector
-        crr_dscp_deficit_pkts_pair->value.push_back(deficit);
-
-    } else {
-        if (_debug){
-            click_chatter("%{element} :: %s :: Initializing Deficit vector for DSCP: %d",
-                          this,
-                          __func__,
-                          dscp);
-        }
-
-        // Create vector for packet deficits
-        Vector<uint32_t> deficit_pkts_vector;
-
-        // Inserting current deficit into it
-        deficit_pkts_vector.push_back(deficit);
-
-        // Inserting the vector of deficits into DSCP hashmap
-        dscp_deficit_packets_map.insert(dscp, deficit_pkts_vector);
-    }
+    _stats[dscp & 63].add_deficit(deficit);
 
 }
 
 uint32_t EmpowerQueueInfoBase::get_deficit(int dscp) {
-    // Getting the average deficit from the map..
-    DSCPDeficitMap :: Pair * crr_dscp_deficit_pair = dscp_deficit_map.find_pair(dscp);
-
-    if (crr_dscp_deficit_pair){
-        return crr_dscp_deficit_pair->value;
-    } else {
-        return 0; // Returns empty deficit
-    }
+    return _stats[dscp & 63]._deficit_avg;
 }
 
 void EmpowerQueueInfoBase::process_packet_enqueue(int dscp, Timestamp timestamp){
@@ -165,128 +84,59 @@ void EmpowerQueueInfoBase::process_packet_enqueue(int dscp, Timestamp timestamp)
                       timestamp.unparse().c_str());
     }
 
-    DSCPTimestampEnqueuedPacketsMap :: Pair * crr_dscp_timstamp_enqueued_pkts_pair = dscp_timestamp_enqueued_pkts_map.find_pair(dscp);
-
-    // if DSCP exists in timestamp enqueued packets map
-    if (crr_dscp_timstamp_enqueued_pkts_pair){
-        if (_debug){
-            click_chatter("%{element} :: %s :: Enqueued packets vector size is: %d",
-                          this,
-                          __func__,
-                          crr_dscp_timstamp_enqueued_pkts_pair->value.size());
-        }
-
-        // Include packet timestamp at the end of the vector
-        crr_dscp_timstamp_enqueued_pkts_pair->value.push_back(timestamp);
-
-    } else {
-        if (_debug){
-            click_chatter("%{element} :: %s :: Initializing Timestamp vector for DSCP: %d",
-                          this,
-                          __func__,
-                          dscp);
-        }
-
-        // Create vector for packet timestamps
-        Vector<Timestamp> timestamp_enqueued_pkts_vector;
-
-        // Inserting current time into it
-        timestamp_enqueued_pkts_vector.push_back(timestamp);
+    _stats[dscp & 63]._enqueued++;
 
-        // Inserting the vector of timestamps into DSCP hashmap
-        dscp_timestamp_enqueued_pkts_map.insert(dscp, timestamp_enqueued_pkts_vector);
-    }
 }
 
 Timestamp EmpowerQueueInfoBase::get_queue_delay(int dscp) {
-    // Getting the average latency from the map..
-    DSCPQueueDelayMap :: Pair * crr_dscp_queue_delay_pair = dscp_queue_delay_map.find_pair(dscp);
-
-    if (crr_dscp_queue_delay_pair){
-        return crr_dscp_queue_delay_pair->value;
-    } else {
-        return Timestamp(); // Returns empty timestamp
-    }
+    return _stats[dscp & 63]._delay_avg;
 }
 
-void EmpowerQueueInfoBase::process_packet_dequeue(int dscp, Timestamp timestamp) {
+void EmpowerQueueInfoBase::process_packet_dequeue(int dscp, Timestamp enqueued, Timestamp timestamp) {
+
+    Timestamp crr_queue_delay = timestamp - enqueued;
 
     if (_debug){
-        click_chatter("%{element} :: %s :: process packet DEqueue for DSCP: %d and Timestamp: %s!",
+        click_chatter("%{element} :: %s :: process packet DEqueue for DSCP: %d and Timestamp: %s, calculated: %s!",
                       this,
                       __func__,
                       dscp,
-                      timestamp.unparse().c_str());
+                      timestamp.unparse().c_str(),
+                      crr_queue_delay.unparse_interval().c_str());
     }
 
-    DSCPTimestampEnqueuedPacketsMap :: Pair * crr_dscp_timstamp_enqueued_pkts_pair = dscp_timestamp_enqueued_pkts_map.find_pair(dscp);
-    assert(crr_dscp_timstamp_enqueued_pkts_pair);
-
-    // Check if the DSCP exists in the hashmap
-    if (crr_dscp_timstamp_enqueued_pkts_pair){
-
-        // Check if there is at least one packet in the vector
-        if (crr_dscp_timstamp_enqueued_pkts_pair->value.size() > 0) {
-
-            Vector<Timestamp>::const_iterator first_timestamp = crr_dscp_timstamp_enqueued_pkts_pair->value.begin();
-
-            // Calculate queue delay for the DSCP
-            Timestamp crr_queue_delay = timestamp - *first_timestamp;
-
-            if (_debug){
-                click_chatter("%{element} :: %s :: First timestamp: %s vs current: %s, calculated: %s, unparse_interval: %s!",
-                              this,
-                              __func__,
-                              first_timestamp->unparse().c_str(),
-                              timestamp.unparse().c_str(),
-                              crr_queue_delay.unparse().c_str(),
-                              crr_queue_delay.unparse_interval().c_str());
-            }
-
-            // Add delay into the DSCP delay packets map
-            DSCPDelayPacketsMap :: Pair * crr_dscp_delay_pkts_pair = dscp_delay_packets_map.find_pair(dscp);
-
-            if (crr_dscp_delay_pkts_pair){
-
-                // Adding the crr delay into de map
-                crr_dscp_delay_pkts_pair->value.push_back(crr_queue_delay);
-
-                if (_debug){
-                    click_chatter("%{element} :: %s :: DSCP: %d and size(): %d!",
-                                  this,
-                                  __func__,
-                                  dscp,
-                                  crr_dscp_delay_pkts_pair->value.size());
-                }
-
-            } else {
-                // Creating vector and adding the delay into it
-                Vector<Timestamp> crr_delays_vector;
-                crr_delays_vector.push_back(crr_queue_delay);
-
-                // Inserting it in the map!
-                dscp_delay_packets_map.insert(dscp, crr_delays_vector);
-            }
-
-            // Remove first timestamp from the vector
-            crr_dscp_timstamp_enqueued_pkts_pair->value.pop_front();
-        } else {
-            if (_debug) {
-                click_chatter(
-                        "%{element} :: %s :: error: skipping packet DEqueue because timestamp vector is empty or not valid!",
-                        this, __func__);
-            }
-        }
-    } else {
-        if (_debug){
-            click_chatter("%{element} :: %s :: error: packet DEqueue hashmap pair not valid!", this, __func__);
+    if (crr_queue_delay < Timestamp()) {
+        crr_queue_delay = Timestamp();
+    }
+
+    _stats[dscp & 63].add_delay(crr_queue_delay.usecval());
+
+}
+
+String EmpowerQueueInfoBase::list_delays() {
+    StringAccum sa;
+    for (int i = 0; i < 64; i++) {
+        const QueueDelayStats *stats = &_stats[i];
+        if (!stats->_enqueued && !stats->_dequeued) {
+            continue;
         }
+        sa << "dscp " << i;
+        sa << " enqueued " << stats->_enqueued;
+        sa << " dequeued " << stats->_dequeued;
+        sa << " avg " << stats->_delay_avg.usecval();
+        sa << " ewma " << stats->ewma();
+        sa << " p50 " << stats->_p50;
+        sa << " p95 " << stats->_p95;
+        sa << " p99 " << stats->_p99;
+        sa << " deficit " << stats->_deficit_avg << "\n";
     }
+    return sa.take_string();
 }
 
 enum {
     H_DEBUG,
-    H_PERIOD
+    H_PERIOD,
+    H_DELAYS
 };
 
 String EmpowerQueueInfoBase::read_handler(Element *e, void *thunk) {
@@ -296,6 +146,8 @@ String EmpowerQueueInfoBase::read_handler(Element *e, void *thunk) {
             return String(td->_debug) + "\n";
         case H_PERIOD:
             return String(td->_period) + "\n";
+        case H_DELAYS:
+            return td->list_delays();
         default:
             return String();
     }
@@ -319,8 +171,8 @@ int EmpowerQueueInfoBase::write_handler(const String &in_s, Element *e,
             int period;
             if (!IntArg().parse(s, period))
                 return errh->error("period parameter must integer");
-            if (period > 100)
-                return errh->error("period parameter has to be bigger than 100 usec");
+            if (period < 100)
+                return errh->error("period parameter must be at least 100 msec");
             f->_period = period;
             break;
         }
@@ -333,6 +185,7 @@ void EmpowerQueueInfoBase::add_handlers() {
     add_write_handler("debug", write_handler, (void *) H_DEBUG);
     add_read_handler("period", read_handler, (void *) H_PERIOD);
     add_write_handler("period", write_handler, (void *) H_PERIOD);
+    add_read_handler("delays", read_handler, (void *) H_DELAYS);
 }
 
 CLICK_ENDDECLS
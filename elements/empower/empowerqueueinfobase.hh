@@ -5,6 +5,7 @@
 #include <click/element.hh>
 #include <click/hashmap.hh>
 #include <click/timer.hh>
+#include <click/integers.hh>
 
 CLICK_DECLS
 
@@ -19,35 +20,132 @@ Holds queue delay per slice.
 
 =d
 
-Holds average/median queue delay per slice.
+Holds queue delay and deficit statistics per slice (DSCP). For each DSCP
+it keeps the average queue delay and deficit of the last PERIOD, an EWMA
+of the queue delay, and the 50th, 95th and 99th percentile of the queue
+delay over the last PERIOD.
 
 =over 8
 
 =item EL
 An EmpowerLVAPManager element
 
+=item PERIOD
+Statistics period in msec. Default is 500.
+
 =item DEBUG
 Turn debug on/off
 
 =back
 
+=h delays read-only
+Per DSCP statistics: packets enqueued and dequeued, average, EWMA and
+percentiles of the queue delay (usec), and average deficit.
+
 =a EmpowerQueueInfoBase
 */
 
-// Key: DSCP value (int)
-typedef HashMap<int, Vector<Timestamp> > DSCPTimestampEnqueuedPacketsMap;
-
-// Key: DSCP value (int)
-typedef HashMap<int, Vector<Timestamp> > DSCPDelayPacketsMap;
-
-// Key: DSCP value (int)
-typedef HashMap<int, Timestamp> DSCPQueueDelayMap;
+/*
+ * Streaming queue delay and deficit statistics for one DSCP. Per packet
+ * updates are O(1) and do not allocate: delays are accumulated in a
+ * running sum, an EWMA and a log-scale histogram with 4 buckets per
+ * power of two. The averages and percentiles of the last period are
+ * computed by the timer.
+ */
+class QueueDelayStats {
+public:
 
-// Key: DSCP value (int)
-typedef HashMap<int, Vector<uint32_t> > DSCPDeficitPacketsMap;
+    enum { NB_BUCKETS = 124, EWMA_SHIFT = 3 };
+
+    // current period
+    uint64_t _delay_sum; // in usec
+    uint32_t _delay_count;
+    uint64_t _deficit_sum;
+    uint32_t _deficit_count;
+    uint32_t _histogram[NB_BUCKETS];
+
+    // lifetime
+    uint32_t _enqueued;
+    uint32_t _dequeued;
+    uint32_t _ewma_scaled; // in usec << EWMA_SHIFT
+
+    // last period
+    Timestamp _delay_avg;
+    uint32_t _deficit_avg;
+    uint32_t _p50;
+    uint32_t _p95;
+    uint32_t _p99;
+
+    QueueDelayStats() : _delay_sum(0), _delay_count(0), _deficit_sum(0), _deficit_count(0),
+        _enqueued(0), _dequeued(0), _ewma_scaled(0), _deficit_avg(0), _p50(0), _p95(0), _p99(0) {
+        memset(_histogram, 0, sizeof(_histogram));
+    }
+
+    uint32_t ewma() const { return _ewma_scaled >> EWMA_SHIFT; }
+
+    void add_delay(uint32_t usec) {
+        _dequeued++;
+        _delay_sum += usec;
+        _delay_count++;
+        _histogram[bucket(usec)]++;
+        _ewma_scaled += usec - (_ewma_scaled >> EWMA_SHIFT);
+    }
+
+    void add_deficit(uint32_t deficit) {
+        _deficit_sum += deficit;
+        _deficit_count++;
+    }
+
+    // close the current period
+    void update() {
+        if (_delay_count) {
+            _delay_avg = Timestamp::make_usec(_delay_sum / _delay_count);
+            _p50 = percentile(50);
+            _p95 = percentile(95);
+            _p99 = percentile(99);
+            memset(_histogram, 0, sizeof(_histogram));
+        } else {
+            _delay_avg = Timestamp();
+        }
+        _deficit_avg = _deficit_count ? _deficit_sum / _deficit_count : 0;
+        _delay_sum = 0;
+        _delay_count = 0;
+        _deficit_sum = 0;
+        _deficit_count = 0;
+    }
+
+    // values below 4 usec get their own bucket, then 4 buckets per power of two
+    static uint32_t bucket(uint32_t usec) {
+        if (usec < 4) {
+            return usec;
+        }
+        uint32_t msb = 32 - ffs_msb(usec);
+        return ((msb - 1) << 2) | ((usec >> (msb - 2)) & 3);
+    }
+
+    // midpoint of a bucket in usec
+    static uint32_t bucket_value(uint32_t bucket) {
+        if (bucket < 4) {
+            return bucket;
+        }
+        uint32_t msb = (bucket >> 2) + 1;
+        uint32_t width = 1 << (msb - 2);
+        return (4 | (bucket & 3)) * width + width / 2;
+    }
+
+    uint32_t percentile(uint32_t pct) const {
+        uint32_t rank = ((uint64_t) _delay_count * pct + 99) / 100;
+        uint32_t seen = 0;
+        for (uint32_t i = 0; i < NB_BUCKETS; i++) {
+            seen += _histogram[i];
+            if (seen >= rank) {
+                return bucket_value(i);
+            }
+        }
+        return 0;
+    }
 
-// Key: DSCP value (int)
-typedef HashMap<int, uint32_t> DSCPDeficitMap;
+};
 
 class EmpowerQueueInfoBase : public Element {
 public:
@@ -62,11 +160,11 @@ public:
     int initialize(ErrorHandler *);
     int configure(Vector<String>&, ErrorHandler*);
 
-    // SRC (EtherAddress), DST (EtherAddress), BSSID (EtherAddress), DSCP (int), and timestamp (int)
+    // DSCP (int) and timestamp (int)
     void process_packet_enqueue(int, Timestamp);
 
-    // DSCP (int) and timestamp (int)
-    void process_packet_dequeue(int, Timestamp);
+    // DSCP (int), enqueue timestamp and dequeue timestamp
+    void process_packet_dequeue(int, Timestamp, Timestamp);
 
     // DSCP (int) and deficit (int)
     void process_packet_deficit(int, int);
@@ -77,6 +175,9 @@ public:
     // DSCP (int) returns the deficit in uint32_t format
     uint32_t get_deficit(int);
 
+    // DSCP (int) returns the delay statistics
+    const QueueDelayStats *get_stats(int dscp) { return &_stats[dscp & 63]; }
+
     void add_handlers();
 
     void run_timer(Timer *);
@@ -92,29 +193,11 @@ private:
     Timer _timer;
 
     /*
-     * Structure for holding the last TX packets timestamp according to its DSCP values
+     * Statistics per DSCP (Slice)
      */
-    DSCPTimestampEnqueuedPacketsMap dscp_timestamp_enqueued_pkts_map;
+    QueueDelayStats _stats[64];
 
-    /*
-     * Structure for holding delay info per DSCP (Slice)
-     */
-    DSCPQueueDelayMap dscp_queue_delay_map;
-
-    /*
-     * Structure for holding last transmitted packet delays per DSCP (Slice)
-     */
-    DSCPDelayPacketsMap dscp_delay_packets_map;
-
-    /*
-     * Structure for holding last transmitted packet deficits per DSCP (Slice)
-     */
-    DSCPDeficitPacketsMap dscp_deficit_packets_map;
-
-    /*
-     * Structure for holding last deficits needed to transmit per DSCP (Slice)
-     */
-    DSCPDeficitMap dscp_deficit_map;
+    String list_delays();
 
     static int write_handler(const String &, Element *, void *, ErrorHandler *);
     static String read_handler(Element *, void *);
@@ -16,6 +16,8 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <click/config.h>
 #include "empowerregmon.hh"
 #include <click/args.hh>
@@ -26,23 +28,45 @@
 CLICK_DECLS
 
 EmpowerRegmon::EmpowerRegmon() :
-		_el(0), _iface_id(0), _elem_period(4000), _reg_period(1000),
-		_timer(this), _debug(false), _register_log_file(0), _last_mac_ticks(0) {
+		_el(0), _iface_id(0), _elem_period(4000), _reg_period(1000), _history(100),
+		_timer(this), _debug(false), _register_log_fd(-1), _buffer_len(0),
+		_last_mac_ticks(0), _bytes(0), _lines(0), _malformed(0), _overruns(0),
+		_last_sample(0) {
 }
 
 EmpowerRegmon::~EmpowerRegmon() {
+	if (_register_log_fd >= 0) {
+		close(_register_log_fd);
+	}
+}
+
+bool EmpowerRegmon::open_register_log() {
+
+	String register_log_file_path = _debugfs + "/register_log";
+	_register_log_fd = open(register_log_file_path.c_str(), O_RDONLY | O_NONBLOCK);
+
+	if (_register_log_fd < 0) {
+		click_chatter("%{element} :: %s :: unable to open file %s",
+					  this,
+					  __func__,
+					  register_log_file_path.c_str());
+		return false;
+	}
+
+	return true;
+
 }
 
 
 int EmpowerRegmon::initialize(ErrorHandler *) {
 
-	RegmonRegister reg_tx = RegmonRegister(EMPOWER_REGMON_TX, _iface_id, 100);
+	RegmonRegister reg_tx = RegmonRegister(EMPOWER_REGMON_TX, _iface_id, _history);
 	_registers.push_back(reg_tx);
 
-	RegmonRegister reg_rx = RegmonRegister(EMPOWER_REGMON_RX, _iface_id, 100);
+	RegmonRegister reg_rx = RegmonRegister(EMPOWER_REGMON_RX, _iface_id, _history);
 	_registers.push_back(reg_rx);
 
-	RegmonRegister reg_ed = RegmonRegister(EMPOWER_REGMON_ED, _iface_id, 100);
+	RegmonRegister reg_ed = RegmonRegister(EMPOWER_REGMON_ED, _iface_id, _history);
 	_registers.push_back(reg_ed);
 
 	_last_mac_ticks = 0;
@@ -61,17 +85,12 @@ int EmpowerRegmon::initialize(ErrorHandler *) {
 					  period_file_path.c_str());
 	}
 
-	// flush measurements register and keep the file open
-	// due to bugs in the driver patch, the fread can return more data than the one available in the buffer
-	// it is also likely that the read handler reports lines instead of bytes
-	String register_log_file_path = _debugfs + "/register_log";
-	_register_log_file = fopen(register_log_file_path.c_str(), "r");
-	char* buffer[8192];
-	int nread;
-
-	do {
-		nread = fread(&buffer, 1, sizeof buffer, _register_log_file);
-	} while (nread > 0); // fixme, read operation could be slower than kernel measurements writing
+	// flush measurements register and keep the file open, afterwards
+	// every run only reads what the driver appended in the meantime
+	if (open_register_log()) {
+		while (read(_register_log_fd, _buffer, sizeof(_buffer)) > 0)
+			; // fixme, read operation could be slower than kernel measurements writing
+	}
 
 	_timer.initialize(this);
 	_timer.schedule_now();
@@ -93,88 +112,195 @@ int EmpowerRegmon::configure(Vector<String> &conf, ErrorHandler *errh) {
 			  .read_m("IFACE_ID", _iface_id)
 			  .read("ELEM_PERIOD", _elem_period)
 			  .read("REG_PERIOD", _reg_period)
+			  .read("HISTORY", _history)
 			  .read_m("DEBUGFS", _debugfs)
 			  .read("DEBUG", _debug).complete();
 
+	if (ret >= 0 && _history < 1) {
+		return errh->error("HISTORY must be at least 1");
+	}
+
 	return ret;
 
 }
 
+// Returns the coarsest history tier whose resolution does not exceed the
+// requested one (in ms), the raw samples if none does.
+int EmpowerRegmon::tier(uint32_t resolution) const {
+	int t = 0;
+	uint64_t period = (uint64_t) _reg_period * RegmonRegister::REGMON_TIER_FACTOR;
+	while (t + 1 < RegmonRegister::REGMON_TIERS && period <= resolution) {
+		t++;
+		period *= RegmonRegister::REGMON_TIER_FACTOR;
+	}
+	return t;
+}
+
+// Parses one "sec,nsec,<unused>,mac_ticks,tx,rx,ed" line in place, the first
+// two fields are decimal and the others hexadecimal. As with strtoul, parsing
+// of a field stops at the first invalid character. Returns false if the line
+// has too few fields.
+static bool parse_regmon_line(const char *s, const char *end, uint32_t *fields) {
+
+	enum { REGMON_FIELDS = 7 };
+
+	int field = 0;
+	bool stop = false;
+	bool digits = false;
+	uint32_t value = 0;
+
+	for (; s < end; s++) {
+		char c = *s;
+		if (c == ',') {
+			if (field < REGMON_FIELDS) {
+				fields[field] = value;
+			}
+			field++;
+			value = 0;
+			stop = false;
+			digits = false;
+			continue;
+		}
+		if (stop || field == 2 || field >= REGMON_FIELDS) {
+			continue;
+		}
+		uint32_t d;
+		if (c >= '0' && c <= '9') {
+			d = c - '0';
+		} else if (field > 2 && c >= 'a' && c <= 'f') {
+			d = c - 'a' + 10;
+		} else if (field > 2 && c >= 'A' && c <= 'F') {
+			d = c - 'A' + 10;
+		} else if (field > 2 && (c == 'x' || c == 'X') && value == 0 && digits) {
+			continue; // 0x prefix
+		} else if ((c == ' ' || c == '\t') && !digits) {
+			continue;
+		} else {
+			stop = true;
+			continue;
+		}
+		value = value * (field > 2 ? 16 : 10) + d;
+		digits = true;
+	}
+
+	if (field < REGMON_FIELDS) {
+		fields[field] = value;
+	}
+
+	return field + 1 >= REGMON_FIELDS;
+
+}
+
+void EmpowerRegmon::process_line(const char *s, const char *end) {
+
+	uint32_t fields[7];
+
+	if (!parse_regmon_line(s, end, fields)) {
+		_malformed++;
+		return;
+	}
+
+	uint32_t sec = fields[0];
+	uint32_t nsec = fields[1];
+	uint32_t mac_ticks = fields[3];
+	uint32_t tx = fields[4];
+	uint32_t rx = fields[5];
+	uint32_t ed = fields[6];
+
+	bool valid;
+	uint32_t mac_ticks_delta = 0;
+
+	if (mac_ticks < _last_mac_ticks) {
+
+		_last_mac_ticks = mac_ticks;
+		valid = false;
+	}
+	else {
+
+		mac_ticks_delta = mac_ticks - _last_mac_ticks;
+		_last_mac_ticks = mac_ticks;
+		valid = true;
+	}
+
+	uint64_t ts_int = sec * 1000000LL + nsec / 1000;
+	_registers[EMPOWER_REGMON_TX].add_sample(ts_int, tx, mac_ticks_delta, valid);
+	_registers[EMPOWER_REGMON_RX].add_sample(ts_int, rx, mac_ticks_delta, valid);
+	_registers[EMPOWER_REGMON_ED].add_sample(ts_int, ed, mac_ticks_delta, valid);
+
+	_last_sample = ts_int;
+	_lines++;
+
+}
+
 void EmpowerRegmon::run_timer(Timer *) {
 
 	Timestamp start = Timestamp::now();
 
-	FILE * fp;
-	char * line = NULL;
-	size_t len = 0;
-	ssize_t read;
-
-	String register_log_file_path = _debugfs + "/register_log";
-	fp = fopen(register_log_file_path.c_str(), "r");
+	_timer.reschedule_after_msec(_elem_period);
 
-	if (fp == NULL) {
-		click_chatter("%{element} :: %s :: unable to open file %s",
-					  this,
-					  __func__,
-					  register_log_file_path.c_str());
-		_timer.schedule_after_msec(_elem_period);
+	if (_register_log_fd < 0 && !open_register_log()) {
 		return;
 	}
 
-	while ((read = getline(&line, &len, fp)) != -1) {
-		Vector<String> values;
-		char* token = strtok(line, ",");
-		while (token != NULL) {
-			values.push_back(String(token));
-			token = strtok(NULL, ",");
+	while (true) {
+
+		ssize_t nread = read(_register_log_fd, _buffer + _buffer_len, sizeof(_buffer) - _buffer_len);
+
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (nread <= 0) {
+			break;
 		}
-		uint32_t sec = strtoul(values[0].c_str(), NULL, 10);
-		uint32_t nsec = strtoul(values[1].c_str(), NULL, 10);
-		uint32_t mac_ticks = strtoul(values[3].c_str(), NULL, 16);
-		uint32_t tx = strtoul(values[4].c_str(), NULL, 16);
-		uint32_t rx = strtoul(values[5].c_str(), NULL, 16);
-		uint32_t ed = strtoul(values[6].c_str(), NULL, 16);
 
-		bool valid;
-		uint32_t mac_ticks_delta = 0;
+		_bytes += nread;
 
-		if (mac_ticks < _last_mac_ticks) {
+		// parse the complete lines and keep the tail for the next read
+		char *line = _buffer;
+		char *end = _buffer + _buffer_len + nread;
+		char *nl;
 
-			_last_mac_ticks = mac_ticks;
-			valid = false;
+		while ((nl = (char *) memchr(line, '\n', end - line)) != 0) {
+			if (nl > line) {
+				process_line(line, nl);
+			}
+			line = nl + 1;
 		}
-		else {
 
-			mac_ticks_delta = mac_ticks - _last_mac_ticks;
-			_last_mac_ticks = mac_ticks;
-			valid = true;
+		_buffer_len = end - line;
+
+		if (_buffer_len == sizeof(_buffer)) {
+			// no newline in a full buffer, drop it
+			_malformed++;
+			_buffer_len = 0;
+		} else if (_buffer_len && line != _buffer) {
+			memmove(_buffer, line, _buffer_len);
 		}
 
-		uint64_t ts_int = sec * 1000000LL + nsec / 1000;
-		_registers[EMPOWER_REGMON_TX].add_sample(ts_int, tx, mac_ticks_delta, valid);
-		_registers[EMPOWER_REGMON_RX].add_sample(ts_int, rx, mac_ticks_delta, valid);
-		_registers[EMPOWER_REGMON_ED].add_sample(ts_int, ed, mac_ticks_delta, valid);
 	}
 
-	fclose(fp);
+	_last_run_time = Timestamp::now() - start;
+	_busy_time += _last_run_time;
 
-	Timestamp delta = Timestamp::now() -start;
+	if (_last_run_time > _max_run_time) {
+		_max_run_time = _last_run_time;
+	}
 
-	if (delta.msec() > _elem_period) {
+	if (_last_run_time.msec() > _elem_period) {
+		_overruns++;
 		click_chatter("%{element} :: %s :: processing samples took too much time %s",
 				      this,
 					  __func__,
-					  delta.unparse().c_str());
+					  _last_run_time.unparse().c_str());
 	}
 
-	_timer.schedule_after_msec(_elem_period - delta.msec());
-	return;
-
 }
 
 enum {
 	H_STATUS,
 	H_FULL,
+	H_STATS,
 };
 
 String EmpowerRegmon::read_handler(Element *e, void *thunk) {
@@ -190,12 +316,34 @@ String EmpowerRegmon::read_handler(Element *e, void *thunk) {
 	case H_FULL: {
 		for (RegistersIter iter = eg->_registers.begin(); iter != eg->_registers.end(); iter++) {
 			sa << iter->unparse() << "\n";
-			for (int i = 0; i < 100; i++) {
-				sa << iter->_timestamps[i] << " " << iter->_samples[i] << '\n';
+			for (int t = 0; t < RegmonRegister::REGMON_TIERS; t++) {
+				const RegmonTier *tier = iter->tier(t);
+				sa << "Tier=" << t << "\n";
+				for (int i = 0; i < tier->count(); i++) {
+					const RegmonSample &sample = tier->at(i);
+					sa << sample._timestamp << " " << sample._min << " " << sample._avg << " " << sample._max << '\n';
+				}
 			}
 		}
 		return sa.take_string();
 	}
+	case H_STATS: {
+		Timestamp now = Timestamp::now();
+		sa << "bytes " << eg->_bytes << "\n";
+		sa << "lines " << eg->_lines << "\n";
+		sa << "malformed " << eg->_malformed << "\n";
+		sa << "pending " << eg->_buffer_len << "\n";
+		sa << "overruns " << eg->_overruns << "\n";
+		sa << "last_run_time " << eg->_last_run_time << "\n";
+		sa << "max_run_time " << eg->_max_run_time << "\n";
+		if (eg->_busy_time) {
+			sa << "lines_per_sec " << (uint64_t) (eg->_lines * 1000000 / (eg->_busy_time.usecval() + 1)) << "\n";
+		}
+		if (eg->_last_sample) {
+			sa << "sample_lag " << (now - Timestamp::make_usec(eg->_last_sample)) << "\n";
+		}
+		return sa.take_string();
+	}
 	default:
 		return String();
 	}
@@ -204,6 +352,7 @@ String EmpowerRegmon::read_handler(Element *e, void *thunk) {
 void EmpowerRegmon::add_handlers() {
 	add_read_handler("status", read_handler, (void *) H_STATUS);
 	add_read_handler("full", read_handler, (void *) H_FULL);
+	add_read_handler("stats", read_handler, (void *) H_STATS);
 }
 
 CLICK_ENDDECLS
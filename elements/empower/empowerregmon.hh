@@ -6,46 +6,142 @@
 #include <click/vector.hh>
 #include <click/straccum.hh>
 #include <unistd.h>
+#include <click/timestamp.hh>
 #include "empowerlvapmanager.hh"
 CLICK_DECLS
 
 
+struct RegmonSample {
+	uint64_t _timestamp; // start of the interval, in usec
+	uint32_t _min;
+	uint32_t _avg;
+	uint32_t _max;
+	uint32_t _valid; // number of valid raw samples folded into this one
+};
+
+// Circular history of samples at one resolution. Every factor samples
+// pushed are also folded into one sample for the next, coarser tier.
+// Only valid samples count towards the min/avg/max of the coarser
+// sample; if none of them was valid it keeps the marker of the first.
+class RegmonTier {
+public:
+
+	RegmonTier() : _index(0), _count(0), _acc_sum(0), _acc_count(0), _acc_valid(0) {
+	}
+
+	void init(uint32_t size) {
+		_samples.resize(size);
+		_index = 0;
+		_count = 0;
+		_acc_sum = 0;
+		_acc_count = 0;
+		_acc_valid = 0;
+	}
+
+	void push(const RegmonSample &sample) {
+		_samples[_index] = sample;
+		if (++_index == _samples.size()) {
+			_index = 0;
+		}
+		if (_count < _samples.size()) {
+			_count++;
+		}
+	}
+
+	// Returns true, filling out, once factor samples have been accumulated
+	bool accumulate(const RegmonSample &sample, uint32_t factor, RegmonSample &out) {
+		if (_acc_count == 0) {
+			_acc = sample;
+			_acc_sum = 0;
+			_acc_valid = 0;
+		}
+		if (sample._valid) {
+			if (!_acc_valid || sample._min < _acc._min)
+				_acc._min = sample._min;
+			if (!_acc_valid || sample._max > _acc._max)
+				_acc._max = sample._max;
+			_acc_sum += (uint64_t) sample._avg * sample._valid;
+			_acc_valid += sample._valid;
+		}
+		if (++_acc_count < factor) {
+			return false;
+		}
+		if (_acc_valid) {
+			_acc._avg = _acc_sum / _acc_valid;
+		}
+		_acc._valid = _acc_valid;
+		_acc_count = 0;
+		out = _acc;
+		return true;
+	}
+
+	// i-th stored sample, starting from the oldest one
+	const RegmonSample &at(int i) const {
+		int j = _index - _count + i;
+		return _samples[j < 0 ? j + _samples.size() : j];
+	}
+
+	// index of the oldest sample whose interval starts at or after since
+	int lower_bound(uint64_t since) const {
+		int lo = 0, hi = _count;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (at(mid)._timestamp < since)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	int count() const { return _count; }
+	int index() const { return _index; }
+
+private:
+
+	Vector<RegmonSample> _samples;
+	int _index;
+	int _count;
+
+	RegmonSample _acc;
+	uint64_t _acc_sum;
+	uint32_t _acc_count;
+	uint32_t _acc_valid;
+
+};
+
 class RegmonRegister {
 public:
 
+	enum { REGMON_TIERS = 3, REGMON_TIER_FACTOR = 10 };
+
 	RegmonRegister(empower_regmon_types type, int iface_id, uint32_t size) {
 		_type = type;
 		_iface_id = iface_id;
 		_size = size;
-		_samples = new uint32_t[size]();
-		_timestamps = new uint64_t[size]();
-		_index = 0;
 		_last_value = 0;
 		_skipped = 0;
 		_min_value = 0xffffffff;
 		_max_value = 0;
 		_first_run = true;
-		memset(_samples, 0, _size);
+		for (int t = 0; t < REGMON_TIERS; t++) {
+			_tiers[t].init(size);
+		}
 	}
 
 	void add_sample(uint64_t timestamp, uint32_t value, uint32_t mac_ticks_delta, bool valid) {
 
+		uint32_t sample;
+		bool counted = valid && !_first_run;
+
 		if (_first_run) {
 			_first_run = false;
-			_samples[_index] = 0;
-			_timestamps[_index] = timestamp;
+			sample = 0;
+		} else if (!valid) {
+			sample = 36000;
 		} else {
-
-			if (!valid)
-
-				_samples[_index] = 36000;
-			else {
-
-				uint64_t value_delta = value - _last_value;
-				_samples[_index] = (uint32_t)((value_delta * 18000) / mac_ticks_delta);
-			}
-
-			_timestamps[_index] = timestamp;
+			uint64_t value_delta = value - _last_value;
+			sample = (uint32_t)((value_delta * 18000) / mac_ticks_delta);
 		}
 
 		_last_value = value;
@@ -56,11 +152,20 @@ public:
 		if (value < _min_value)
 			_min_value = value;
 
-		_index++;
-		_index %= _size;
+		// store the raw sample and cascade into the coarser tiers, the
+		// markers of the first and of invalid samples only go in the raw one
+		RegmonSample s = { timestamp, sample, sample, sample, counted ? 1u : 0u };
+		for (int t = 0; t < REGMON_TIERS; t++) {
+			_tiers[t].push(s);
+			if (t + 1 == REGMON_TIERS || !_tiers[t].accumulate(s, REGMON_TIER_FACTOR, s)) {
+				break;
+			}
+		}
 
 	}
 
+	const RegmonTier *tier(int t) const { return &_tiers[t]; }
+
 	String unparse() {
 
 		StringAccum sa;
@@ -75,7 +180,7 @@ public:
 
 		sa << "Id=" << _iface_id << "\t";
 		sa << "Size=" << _size << "\t";
-		sa << "Index=" << _index << "\t";
+		sa << "Index=" << _tiers[0].index() << "\t";
 		sa << "Skipped=" << _skipped << "\t";
 		sa << "MinValue=" << _min_value << "\t\t";
 		sa << "MaxValue=" << _max_value;
@@ -87,20 +192,70 @@ public:
 	empower_regmon_types _type;
 	int _iface_id;
 	int _size;
-	uint32_t *_samples;
-	uint64_t *_timestamps;
-	int _index;
 	uint32_t _last_value;
 	int _skipped;
 	uint32_t _min_value;
 	uint32_t _max_value;
 	bool _first_run;
 
+private:
+
+	RegmonTier _tiers[REGMON_TIERS];
+
 };
 
 typedef Vector<RegmonRegister> Registers;
 typedef Registers::iterator RegistersIter;
 
+/*
+ =c
+
+ EmpowerRegmon(EL, IFACE_ID, DEBUGFS[, I<KEYWORDS>])
+
+ =s EmPOWER
+
+ Samples the busy time registers exported by the regmon driver patch
+
+ =d
+
+ The register_log file under DEBUGFS is kept open and, every ELEM_PERIOD,
+ only the bytes appended since the previous run are read into a fixed
+ buffer and parsed in place. The stats handler reports the reader's
+ throughput and how far it lags behind the driver.
+
+ Keyword arguments are:
+
+ =over 8
+
+ =item EL
+ An EmpowerLVAPManager element
+
+ =item IFACE_ID
+ The interface id
+
+ =item DEBUGFS
+ The regmon debugfs directory
+
+ =item ELEM_PERIOD
+ How often the register log is read, in ms. Default is 4000.
+
+ =item REG_PERIOD
+ The driver sampling interval, in ms. Default is 1000.
+
+ =item HISTORY
+ Number of samples kept by each history tier. Samples are kept at the
+ REG_PERIOD resolution and aggregated (min/avg/max) at 10 and 100 times
+ REG_PERIOD, so the coarsest tier covers HISTORY * 100 * REG_PERIOD.
+ Default is 100.
+
+ =item DEBUG
+ Turn debug on/off
+
+ =back 8
+
+ =a EmpowerLVAPManager
+ */
+
 class EmpowerRegmon: public Element {
 public:
 
@@ -114,6 +269,7 @@ public:
 	int initialize(ErrorHandler *);
 	void run_timer(Timer *);
 	RegmonRegister * registers(int i) { return &_registers.at(i); }
+	int tier(uint32_t resolution) const;
 
 private:
 
@@ -122,15 +278,33 @@ private:
 
 	uint32_t _elem_period; // msecs
 	uint32_t _reg_period; // msecs
+	uint32_t _history; // samples per tier
 	Timer _timer;
 
 	bool _debug;
 
 	String _debugfs;
 
-	FILE *_register_log_file;
+	enum { REGMON_BUFFER_SIZE = 16384 };
+
+	int _register_log_fd;
+	char _buffer[REGMON_BUFFER_SIZE];
+	uint32_t _buffer_len; // bytes of an incomplete line left from the last read
 	uint32_t _last_mac_ticks;
 
+	// reader counters
+	uint64_t _bytes;
+	uint64_t _lines;
+	uint64_t _malformed;
+	uint32_t _overruns;
+	uint64_t _last_sample; // driver timestamp of the last sample, in usec
+	Timestamp _last_run_time;
+	Timestamp _max_run_time;
+	Timestamp _busy_time;
+
+	bool open_register_log();
+	void process_line(const char *, const char *);
+
 	Registers _registers;
 
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
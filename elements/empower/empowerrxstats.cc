@@ -43,39 +43,24 @@ void send_summary_trigger_callback(Timer *timer, void *data) {
 	timer->schedule_after_msec(summary->_period);
 }
 
-void send_rssi_trigger_callback(Timer *timer, void *data) {
-	// process triggers
-	RssiTrigger *rssi = (RssiTrigger *) data;
-	rssi->_ers->lock.acquire_write();
-	for (NTIter iter = rssi->_ers->stas.begin(); iter.live(); iter++) {
-		DstInfo *nfo = &iter.value();
-		// not matching the address
-		if (nfo->_eth != rssi->_eth) {
-			continue;
-		}
-		// check if condition matches
-		if (rssi->matches(nfo) && !rssi->_dispatched) {
-			rssi->_el->send_rssi_trigger(rssi->_trigger_id, nfo->_iface_id, nfo->_sma_rssi->avg());
-			rssi->_dispatched = true;
-		} else if (!rssi->matches(nfo) && rssi->_dispatched) {
-			rssi->_dispatched = false;
-		}
-	}
-	rssi->_ers->lock.release_write();
-	// re-schedule the timer
-	timer->schedule_after_msec(rssi->_period);
-}
-
 EmpowerRXStats::EmpowerRXStats() :
-		_el(0), _timer(this), _signal_offset(0), _period(500),
-		_sma_period(13), _max_silent_window_count(10), _debug(false) {
+		_el(0), _timer(this), _shards(0), _nb_shards(0), _signal_offset(0),
+		_period(500), _sma_period(13), _max_silent_window_count(10),
+		_summary_capacity(4096), _summary_sampling(1), _debug(false) {
 
 }
 
 EmpowerRXStats::~EmpowerRXStats() {
+	delete[] _shards;
 }
 
 int EmpowerRXStats::initialize(ErrorHandler *) {
+	// one shard per thread that can run simple_action
+	_nb_shards = click_max_cpu_ids();
+	if (_nb_shards == 0) {
+		_nb_shards = 1;
+	}
+	_shards = new NeighborShard[_nb_shards];
 	_timer.initialize(this);
 	_timer.schedule_now();
 	return 0;
@@ -88,20 +73,70 @@ int EmpowerRXStats::configure(Vector<String> &conf, ErrorHandler *errh) {
 			.read("SMA_PERIOD", _sma_period)
 			.read("SIGNAL_OFFSET", _signal_offset)
 			.read("PERIOD", _period)
+			.read("SUMMARY_CAPACITY", _summary_capacity)
+			.read("SUMMARY_SAMPLING", _summary_sampling)
 			.read("DEBUG", _debug)
 			.complete();
 
+	if (ret >= 0 && (_summary_capacity < 1 || _summary_capacity > 65535)) {
+		return errh->error("SUMMARY_CAPACITY must be between 1 and 65535");
+	}
+
+	if (ret >= 0 && _summary_sampling < 1) {
+		return errh->error("SUMMARY_SAMPLING must be at least 1");
+	}
+
+	if (ret >= 0 && (_sma_period < 1 || _sma_period > DSTINFO_SMA_MAX_PERIOD)) {
+		return errh->error("SMA_PERIOD must be between 1 and %d", DSTINFO_SMA_MAX_PERIOD);
+	}
+
 	return ret;
 
 }
 
+void EmpowerRXStats::merge_shard(SampleTable &samples, NeighborTable &neighbors) {
+	for (STIter iter = samples.begin(); iter.live();) {
+		NeighborSample *sample = &iter.value();
+		// idle for a whole window, the next frame will recreate it
+		if (sample->_packets == 0) {
+			iter = samples.erase(iter);
+			continue;
+		}
+		DstInfo *nfo = neighbors.get_pointer(iter.key());
+		if (!nfo) {
+			neighbors[iter.key()] = DstInfo();
+			nfo = neighbors.get_pointer(iter.key());
+			nfo->_sma_rssi.set_period(_sma_period);
+			nfo->_iface_id = sample->_iface_id;
+			nfo->_eth = iter.key();
+		}
+		nfo->add_samples(sample->_packets, sample->_accum_rssi, sample->_squares_rssi, sample->_last_received);
+		sample->_packets = 0;
+		sample->_accum_rssi = 0;
+		sample->_squares_rssi = 0;
+		++iter;
+	}
+}
+
 void EmpowerRXStats::run_timer(Timer *) {
-	// process stations
 	lock.acquire_write();
+	// fold the samples collected by the rx threads
+	for (unsigned i = 0; i < _nb_shards; i++) {
+		NeighborShard *shard = &_shards[i];
+		shard->_lock.acquire();
+		merge_shard(shard->_stas, stas);
+		merge_shard(shard->_aps, aps);
+		shard->_lock.release();
+	}
+	// process stations
 	for (NTIter iter = stas.begin(); iter.live();) {
 		// Update stats
 		DstInfo *nfo = &iter.value();
 		nfo->update();
+		// Check rssi triggers against the new average
+		if (!_rssi_index.empty()) {
+			process_rssi_triggers(nfo);
+		}
 		// Delete stale entries
 		if (nfo->_silent_window_count > _max_silent_window_count) {
 			iter = stas.erase(iter);
@@ -153,7 +188,6 @@ EmpowerRXStats::simple_action(Packet *p) {
 	int dir = w->i_fc[1] & WIFI_FC1_DIR_MASK;
 	int type = w->i_fc[0] & WIFI_FC0_TYPE_MASK;
 	int subtype = w->i_fc[0] & WIFI_FC0_SUBTYPE_MASK;
-	int retry = w->i_fc[1] & WIFI_FC1_RETRY;
 	bool station = false;
 
 	// Discard frames that do not have sequence numbers
@@ -208,18 +242,34 @@ EmpowerRXStats::simple_action(Packet *p) {
 
 	uint8_t iface_id = PAINT_ANNO(p);
 
-	lock.acquire_write();
-
 	update_neighbor(ta, station, iface_id, rssi);
 
+	if (_summary_triggers.empty()) {
+		return p;
+	}
+
+	lock.acquire_write();
+
 	// check if frame meta-data should be saved
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		if ((*qi)->_iface != iface_id) {
 			continue;
 		}
 		if ((*qi)->_eth == ta || (*qi)->_eth.is_broadcast()) {
-			Frame frame = Frame(ra, ta, ceh->tsft, ceh->flags, w->i_seq, rssi, ceh->rate, type, subtype, p->length(), retry, station, iface_id);
-			(*qi)->_frames.push_back(frame);
+			summary_entry *entry = (*qi)->reserve();
+			if (!entry) {
+				continue;
+			}
+			entry->set_ra(ra);
+			entry->set_ta(ta);
+			entry->set_tsft(ceh->tsft);
+			entry->set_flags(ceh->flags);
+			entry->set_seq(w->i_seq);
+			entry->set_rssi(rssi);
+			entry->set_rate(ceh->rate);
+			entry->set_length(p->length());
+			entry->set_type(type);
+			entry->set_subtype(subtype);
 		}
 	}
 
@@ -231,85 +281,116 @@ EmpowerRXStats::simple_action(Packet *p) {
 
 void EmpowerRXStats::update_neighbor(EtherAddress ta, bool station, uint8_t iface_id, uint8_t rssi) {
 
-	DstInfo *nfo;
+	NeighborShard *shard = &_shards[click_current_cpu_id() % _nb_shards];
+	SampleTable *samples = station ? &shard->_stas : &shard->_aps;
 
-	if (station) {
-		nfo = stas.get_pointer(ta);
-	} else {
-		nfo = aps.get_pointer(ta);
-	}
+	shard->_lock.acquire();
 
-	if (!nfo) {
-		if (station) {
-			stas[ta] = DstInfo();
-			nfo = stas.get_pointer(ta);
-			nfo->_sma_rssi = new SMA(_sma_period);
-			nfo->_iface_id = iface_id;
-			nfo->_eth = ta;
-		} else {
-			aps[ta] = DstInfo();
-			nfo = aps.get_pointer(ta);
-			nfo->_sma_rssi = new SMA(_sma_period);
-			nfo->_iface_id = iface_id;
-			nfo->_eth = ta;
-		}
+	NeighborSample *sample = samples->get_pointer(ta);
+
+	if (!sample) {
+		samples->set(ta, NeighborSample());
+		sample = samples->get_pointer(ta);
+		sample->_iface_id = iface_id;
 	}
 
 	// Add sample
-	nfo->add_sample(rssi);
+	sample->add_sample(rssi, Timestamp::now());
+
+	shard->_lock.release();
 
 }
 
+void EmpowerRXStats::process_rssi_triggers(DstInfo *nfo) {
+	RssiTriggersList *triggers = _rssi_index.get_pointer(nfo->_eth);
+	if (!triggers) {
+		return;
+	}
+	for (RTIter qi = triggers->begin(); qi != triggers->end(); qi++) {
+		RssiTrigger *rssi = *qi;
+		// check if condition matches, re-arm once it no longer does
+		bool match = rssi->matches(nfo);
+		if (match && !rssi->_dispatched) {
+			_el->send_rssi_trigger(rssi->_trigger_id, nfo->_iface_id, nfo->_sma_rssi.avg());
+			rssi->_dispatched = true;
+		} else if (!match && rssi->_dispatched) {
+			rssi->_dispatched = false;
+		}
+	}
+}
+
 void EmpowerRXStats::add_rssi_trigger(EtherAddress eth, uint32_t trigger_id, empower_trigger_relation rel, int val, uint16_t period) {
 	RssiTrigger * rssi = new RssiTrigger(eth, trigger_id, rel, val, false, period, _el, this);
-	for (RTIter qi = _rssi_triggers.begin(); qi != _rssi_triggers.end(); qi++) {
+	lock.acquire_write();
+	RssiTriggersList &triggers = _rssi_index[eth];
+	for (RTIter qi = triggers.begin(); qi != triggers.end(); qi++) {
 		if (*rssi== **qi) {
 			click_chatter("%{element} :: %s :: trigger already defined (%s), setting sent to false",
 						  this,
 						  __func__,
 						  rssi->unparse().c_str());
 			(*qi)->_dispatched = false;
+			lock.release_write();
+			delete rssi;
 			return;
 		}
 	}
-	rssi->_trigger_timer->assign(&send_rssi_trigger_callback, (void *) rssi);
-	rssi->_trigger_timer->initialize(this);
-	rssi->_trigger_timer->schedule_now();
+	triggers.push_back(rssi);
 	_rssi_triggers.push_back(rssi);
+	lock.release_write();
 }
 
 void EmpowerRXStats::del_rssi_trigger(uint32_t trigger_id) {
+	lock.acquire_write();
 	for (RTIter qi = _rssi_triggers.begin(); qi != _rssi_triggers.end(); qi++) {
 		if ((*qi)->_trigger_id == trigger_id) {
-			(*qi)->_trigger_timer->clear();
+			RssiTrigger *rssi = *qi;
+			RssiTriggersList *triggers = _rssi_index.get_pointer(rssi->_eth);
+			for (RTIter ti = triggers->begin(); ti != triggers->end(); ti++) {
+				if (*ti == rssi) {
+					triggers->erase(ti);
+					break;
+				}
+			}
+			if (triggers->empty()) {
+				_rssi_index.erase(rssi->_eth);
+			}
 			_rssi_triggers.erase(qi);
+			delete rssi;
 			break;
 		}
 	}
+	lock.release_write();
 }
 
 void EmpowerRXStats::clear_triggers() {
 	// clear rssi triggers
+	lock.acquire_write();
 	for (RTIter qi = _rssi_triggers.begin(); qi != _rssi_triggers.end(); qi++) {
-		(*qi)->_trigger_timer->clear();
+		delete *qi;
 	}
 	_rssi_triggers.clear();
+	_rssi_index.clear();
 	// clear summary triggers
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		(*qi)->_trigger_timer->clear();
 		delete *qi;
 	}
 	_summary_triggers.clear();
+	lock.release_write();
 }
 
 void EmpowerRXStats::add_summary_trigger(int iface, EtherAddress addr, uint32_t summary_id, int16_t limit, uint16_t period) {
-	SummaryTrigger * summary = new SummaryTrigger(iface, addr, summary_id, limit, period, _el, this);
+	SummaryTrigger * summary = new SummaryTrigger(iface, addr, summary_id, limit, period, _summary_capacity, _summary_sampling, _el, this);
+	lock.acquire_write();
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		if (*summary == **qi) {
 			click_chatter("%{element} :: %s :: summary already defined (%s), ignoring",
 						  this,
 						  __func__,
 						  summary->unparse().c_str());
+			lock.release_write();
+			delete summary;
 			return;
 		}
 	}
@@ -317,17 +398,21 @@ void EmpowerRXStats::add_summary_trigger(int iface, EtherAddress addr, uint32_t
 	summary->_trigger_timer->initialize(this);
 	summary->_trigger_timer->schedule_now();
 	_summary_triggers.push_back(summary);
+	lock.release_write();
 }
 
 void EmpowerRXStats::del_summary_trigger(uint32_t summary_id) {
+	lock.acquire_write();
 	for (DTIter qi = _summary_triggers.begin(); qi != _summary_triggers.end(); qi++) {
 		if ((*qi)->_trigger_id == summary_id) {
-			(*qi)->_trigger_timer->clear();
+			SummaryTrigger *summary = *qi;
+			summary->_trigger_timer->clear();
 			_summary_triggers.erase(qi);
-			delete *qi;
+			delete summary;
 			break;
 		}
 	}
+	lock.release_write();
 }
 
 enum {
@@ -348,15 +433,13 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 	case H_RSSI_MATCHES: {
 		StringAccum sa;
 		for (RTIter qi = td->_rssi_triggers.begin(); qi != td->_rssi_triggers.end(); qi++) {
-			for (NTIter iter = td->stas.begin(); iter.live(); iter++) {
-				DstInfo *nfo = &iter.value();
-				if (!nfo)
-					continue;
-				if ((*qi)->matches(nfo)) {
-					sa << (*qi)->unparse();
-					sa << " current " << nfo->_sma_rssi->avg();
-					sa << "\n";
-				}
+			DstInfo *nfo = td->stas.get_pointer((*qi)->_eth);
+			if (!nfo)
+				continue;
+			if ((*qi)->matches(nfo)) {
+				sa << (*qi)->unparse();
+				sa << " current " << nfo->_sma_rssi.avg();
+				sa << "\n";
 			}
 		}
 		return sa.take_string();
@@ -370,9 +453,11 @@ String EmpowerRXStats::read_handler(Element *e, void *thunk) {
 	}
 	case H_SUMMARY_TRIGGERS: {
 		StringAccum sa;
+		td->lock.acquire_read();
 		for (DTIter qi = td->_summary_triggers.begin(); qi != td->_summary_triggers.end(); qi++) {
 			sa << (*qi)->unparse() << "\n";
 		}
+		td->lock.release_read();
 		return sa.take_string();
 	}
 	case H_NEIGHBORS: {
@@ -404,8 +489,17 @@ int EmpowerRXStats::write_handler(const String &in_s, Element *e, void *vparam,
 
 	switch ((intptr_t) vparam) {
 	case H_RESET: {
+		f->lock.acquire_write();
+		for (unsigned i = 0; i < f->_nb_shards; i++) {
+			NeighborShard *shard = &f->_shards[i];
+			shard->_lock.acquire();
+			shard->_stas.clear();
+			shard->_aps.clear();
+			shard->_lock.release();
+		}
 		f->stas.clear();
 		f->aps.clear();
+		f->lock.release_write();
 		break;
 	}
 	case H_SIGNAL_OFFSET: {
@@ -26,6 +26,15 @@ CLICK_DECLS
 
  =d
 
+ Received frames are accounted in per-thread neighbor shards, each guarded by
+ its own spinlock, so the RX path never contends with control-plane readers.
+ Every PERIOD the shards are folded into the aps and stas tables, which are
+ the ones served to the controller and to the RSSI triggers.
+
+ RSSI triggers are indexed by station address and evaluated right after the
+ station's moving average is updated, i.e. once every PERIOD. The period
+ requested by the controller for each trigger is ignored.
+
  Keyword arguments are:
 
  =over 8
@@ -33,6 +42,18 @@ CLICK_DECLS
  =item EL
  An EmpowerLVAPManager element
 
+ =item SMA_PERIOD
+ Number of PERIODs averaged in the RSSI moving average, at most 64.
+ Default is 13.
+
+ =item SUMMARY_CAPACITY
+ Maximum number of frames buffered by a summary trigger between two
+ reports; further frames are counted as overflows. Default is 4096.
+
+ =item SUMMARY_SAMPLING
+ Capture one frame every SUMMARY_SAMPLING frames matching a summary
+ trigger. Default is 1.
+
  =item DEBUG
  Turn debug on/off
 
@@ -44,9 +65,42 @@ CLICK_DECLS
 typedef HashTable<EtherAddress, DstInfo> NeighborTable;
 typedef NeighborTable::iterator NTIter;
 
+class NeighborSample {
+public:
+	int _packets;
+	int _accum_rssi;
+	int _squares_rssi;
+	int _iface_id;
+	Timestamp _last_received;
+
+	NeighborSample() : _packets(0), _accum_rssi(0), _squares_rssi(0), _iface_id(-1) {
+	}
+
+	void add_sample(uint8_t rssi, const Timestamp &now) {
+		_packets++;
+		_accum_rssi += rssi;
+		_squares_rssi += rssi * rssi;
+		_last_received = now;
+	}
+};
+
+typedef HashTable<EtherAddress, NeighborSample> SampleTable;
+typedef SampleTable::iterator STIter;
+
+class NeighborShard {
+public:
+	SimpleSpinlock _lock;
+	SampleTable _aps;
+	SampleTable _stas;
+	char _pad[CLICK_CACHE_LINE_SIZE];
+};
+
 typedef Vector<RssiTrigger *> RssiTriggersList;
 typedef RssiTriggersList::iterator RTIter;
 
+typedef HashTable<EtherAddress, RssiTriggersList> RssiTriggersIndex;
+typedef RssiTriggersIndex::iterator RTIIter;
+
 typedef Vector<SummaryTrigger *> SummaryTriggersList;
 typedef SummaryTriggersList::iterator DTIter;
 
@@ -89,13 +143,19 @@ private:
 	EmpowerLVAPManager *_el;
 	Timer _timer;
 
+	NeighborShard *_shards;
+	unsigned _nb_shards;
+
 	RssiTriggersList _rssi_triggers;
+	RssiTriggersIndex _rssi_index;
 	SummaryTriggersList _summary_triggers;
 
 	int _signal_offset;
 	unsigned _period; // in ms
 	unsigned _sma_period;
 	unsigned _max_silent_window_count; // in number of windows
+	uint32_t _summary_capacity; // frames per summary report
+	uint32_t _summary_sampling; // capture one frame every N
 
 	bool _debug;
 
@@ -103,6 +163,8 @@ private:
 	static String read_handler(Element *, void *);
 
 	void update_neighbor(EtherAddress, bool, uint8_t, uint8_t);
+	void merge_shard(SampleTable &, NeighborTable &);
+	void process_rssi_triggers(DstInfo *);
 
 };
 
@@ -63,12 +63,12 @@ void EmpowerTee::push(int, Packet *p) {
 
 	// frame is unicast then send only to the correct interface
 	if (!dst.is_broadcast() && !dst.is_group()) {
-		EmpowerStationState *ess = _el->get_ess(dst);
-		if (!ess) {
+		const EmpowerStationView *esv = _el->get_station(dst);
+		if (!esv) {
 			p->kill();
 			return;
 		}
-		output(ess->_iface_id).push(p);
+		output(esv->_iface_id).push(p);
 		return;
 	}
 
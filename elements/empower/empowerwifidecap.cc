@@ -46,6 +46,25 @@ int EmpowerWifiDecap::configure(Vector<String> &conf,
 
 }
 
+inline void
+EmpowerWifiDecap::mirror(Packet *p) {
+
+	if (noutputs() < 2) {
+		return;
+	}
+
+	// only clone the frames that EmpowerTee would not drop
+	EtherAddress dst = EtherAddress(p->data());
+
+	if (!dst.is_group() && !_el->get_station(dst)) {
+		return;
+	}
+
+	if (Packet *clone = p->clone())
+		output(1).push(clone);
+
+}
+
 void
 EmpowerWifiDecap::push(int, Packet *p) {
 
@@ -127,9 +146,9 @@ EmpowerWifiDecap::push(int, Packet *p) {
 		return;
 	}
 
-    EmpowerStationState *ess = _el->get_ess(src);
+	const EmpowerStationView *ess = _el->get_station(src);
 
-    if (!ess) {
+	if (!ess) {
 		p->kill();
 		return;
 	}
@@ -163,17 +182,12 @@ EmpowerWifiDecap::push(int, Packet *p) {
 		return;
 	}
 
-	WritablePacket *p_out = p->uniqueify();
-	if (!p_out) {
-		return;
-	}
-
-	TxPolicyInfo * txp = _el->get_txp(src);
+	TxPolicyInfo * txp = ess->_txp;
 
 	// frame must be encapsulated in another Ethernet frame
 	if (ess->_encap) {
 
-		p_out = p_out->push_mac_header(14);
+		WritablePacket *p_out = p->push_mac_header(sizeof(struct click_ether));
 
 		if (!p_out) {
 			return;
@@ -187,42 +201,41 @@ EmpowerWifiDecap::push(int, Packet *p) {
 
 		txp->update_rx(p_out->length());
 
-		if (Packet *clone = p->clone())
-			output(1).push(clone);
+		mirror(p_out);
 
-		output(0).push(p);
+		output(0).push(p_out);
 
 		return;
 
 	}
 
 	// normal wifi decap
-	uint16_t ether_type;
-	if (!memcmp(WIFI_LLC_HEADER, p_out->data() + wifi_header_size, WIFI_LLC_HEADER_LEN)) {
-		memcpy(&ether_type, p_out->data() + wifi_header_size + sizeof(click_llc) - 2, 2);
-	} else {
-		p_out->kill();
+	if (p->length() < wifi_header_size + sizeof(struct click_llc) ||
+		memcmp(WIFI_LLC_HEADER, p->data() + wifi_header_size, WIFI_LLC_HEADER_LEN)) {
+		p->kill();
 		return;
 	}
 
-	p_out->pull(wifi_header_size + sizeof(struct click_llc));
-
-	p_out = p_out->push_mac_header(14);
+	// the last 14 bytes of the 802.11 + LLC header are rewritten in place
+	// into the Ethernet header, the LLC ether type is already where the
+	// Ethernet one goes. uniqueify() only copies frames that are shared.
+	WritablePacket *p_out = p->uniqueify();
 
 	if (!p_out) {
 		return;
 	}
 
+	p_out->pull(wifi_header_size + sizeof(struct click_llc) - sizeof(struct click_ether));
+	p_out->set_mac_header(p_out->data(), sizeof(struct click_ether));
+
 	memcpy(p_out->data(), dst.data(), 6);
 	memcpy(p_out->data() + 6, src.data(), 6);
-	memcpy(p_out->data() + 12, &ether_type, 2);
 
 	txp->update_rx(p_out->length());
 
-	if (Packet *clone = p->clone())
-		output(1).push(clone);
+	mirror(p_out);
 
-	output(0).push(p);
+	output(0).push(p_out);
 
 }
 
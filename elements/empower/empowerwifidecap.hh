@@ -23,6 +23,10 @@ than the length of the 802.11 frame header and LLC header and packets
 that do not have a LVAP or packets coming from station that have not
 completed the authentication and the association procedure.
 
+Decapsulated frames are pushed to output 0. If output 1 is connected, a
+clone of each frame addressed to a group address or to another LVAP is
+also pushed there (e.g. to an EmpowerTee), other frames are not mirrored.
+
 =over 8
 
 =item EL
@@ -43,7 +47,7 @@ public:
 	~EmpowerWifiDecap();
 
 	const char *class_name() const { return "EmpowerWifiDecap"; }
-	const char *port_count() const { return "1/2"; }
+	const char *port_count() const { return "1/1-2"; }
 	const char *processing() const { return AGNOSTIC; }
 
 	int configure(Vector<String> &, ErrorHandler *);
@@ -54,6 +58,8 @@ public:
 
 private:
 
+	inline void mirror(Packet *p);
+
 	class EmpowerLVAPManager *_el;
 
 	bool _debug;
@@ -7,77 +7,61 @@
 #include <click/vector.hh>
 CLICK_DECLS
 
+// Simple moving average over the last period samples, stored inline in a
+// window of at most N entries so that the owner needs no heap allocation
+// and can be copied freely.
+template <unsigned N>
 class SMA {
 public:
-	SMA(unsigned int period) :
-		period(period), head(NULL), tail(NULL), total(0) {
-		window = new int[period];
-		assert(period >= 1);
+	SMA(unsigned int period = N) {
+		set_period(period);
 	}
-	~SMA() {
-		delete[] window;
+
+	// Changes the averaging period and drops all samples
+	void set_period(unsigned int p) {
+		assert(p >= 1 && p <= N);
+		period = p;
+		head = 0;
+		count = 0;
+		total = 0;
 	}
+
 	// Adds a value to the average, pushing one out if necessary
 	void add(int val) {
-		// Special case: Initialisation
-		if (head == NULL) {
-			head = window;
-			*head = val;
-			tail = head;
-			inc(tail);
-			total = val;
-			return;
+		unsigned int tail = head + count;
+		if (tail >= period) {
+			tail -= period;
 		}
 		// Were we already full?
-		if (head == tail) {
-			// Fix total-cache
-			total -= *head;
-			// Make room
-			inc(head);
+		if (count == period) {
+			// Fix total-cache and make room
+			total -= window[head];
+			if (++head == period) {
+				head = 0;
+			}
+		} else {
+			count++;
 		}
-		// Write the value in the next spot.
-		*tail = val;
-		inc(tail);
-		// Update our total-cache
+		// Write the value in the next spot and update our total-cache
+		window[tail] = val;
 		total += val;
 	}
 
 	// Returns the average of the last P elements added to this SMA.
 	// If no elements have been added yet, returns 0.0
 	int avg() const {
-		ptrdiff_t size = this->size();
-		if (size == 0) {
+		if (count == 0) {
 			return 0; // No entries => 0 average
 		}
-		return (total / (double) size);
+		return (total / (double) count);
 	}
 
 private:
+	int window[N]; // Holds the values to calculate the average of.
 	unsigned int period;
-	int * window; // Holds the values to calculate the average of.
-
-	// Logically, head is before tail
-	int * head; // Points at the oldest element we've stored.
-	int * tail; // Points at the newest element we've stored.
-
+	unsigned int head; // Index of the oldest element we've stored.
+	unsigned int count; // How many numbers we have stored.
 	int total; // Cache the total so we don't sum everything each time.
-
-	// Bumps the given pointer up by one.
-	// Wraps to the start of the array if needed.
-	void inc(int * & p) {
-		if (++p >= window + period) {
-			p = window;
-		}
-	}
-
-	// Returns how many numbers we have stored.
-	ptrdiff_t size() const {
-		if (head == NULL)
-			return 0;
-		if (head == tail)
-			return period;
-		return (period + tail - head) % period;
-	}
 };
 
 CLICK_ENDDECLS
@@ -22,13 +22,27 @@
 CLICK_DECLS
 
 SummaryTrigger::SummaryTrigger(int iface, EtherAddress eth, uint32_t trigger_id, int16_t limit,
-		uint16_t period, EmpowerLVAPManager * el, EmpowerRXStats * ers) :
-		Trigger(trigger_id, period, el, ers), _eth(eth), _iface(iface), _sent(0), _limit(limit) {
-
+		uint16_t period, uint32_t capacity, uint32_t sampling, EmpowerLVAPManager * el, EmpowerRXStats * ers) :
+		Trigger(trigger_id, period, el, ers), _eth(eth), _iface(iface), _sent(0), _limit(limit),
+		_nb_entries(0), _capacity(capacity), _sampling(sampling), _matched(0), _overflows(0) {
+	_entries = new summary_entry[_capacity];
 }
 
 SummaryTrigger::~SummaryTrigger() {
-	_frames.clear();
+	delete[] _entries;
+}
+
+// Returns the slot for the next frame or NULL if the frame is not sampled
+// or the buffer is full
+summary_entry *SummaryTrigger::reserve() {
+	if (_sampling > 1 && (_matched++ % _sampling) != 0) {
+		return 0;
+	}
+	if (_nb_entries == _capacity) {
+		_overflows++;
+		return 0;
+	}
+	return &_entries[_nb_entries++];
 }
 
 String SummaryTrigger::unparse() {
@@ -41,7 +55,13 @@ String SummaryTrigger::unparse() {
 	sa << " period ";
 	sa << _period;
 	sa << " frames ";
-	sa << _frames.size();
+	sa << _nb_entries;
+	sa << " capacity ";
+	sa << _capacity;
+	sa << " sampling ";
+	sa << _sampling;
+	sa << " overflows ";
+	sa << _overflows;
 	sa << " sent ";
 	sa << _sent;
 	return sa.take_string();
@@ -5,11 +5,9 @@
 #include <click/timer.hh>
 #include <click/vector.hh>
 #include "trigger.hh"
-#include "frame.hh"
 CLICK_DECLS
 
-typedef Vector<Frame> FramesList;
-typedef FramesList::iterator FIter;
+struct summary_entry;
 
 class SummaryTrigger: public Trigger {
 
@@ -19,13 +17,28 @@ public:
 	int _iface;
 	uint32_t _sent;
 	int16_t _limit;
-	FramesList _frames;
 
-	SummaryTrigger(int, EtherAddress, uint32_t, int16_t, uint16_t, EmpowerLVAPManager *, EmpowerRXStats *);
+	// captured frames, already in the on-wire layout
+	summary_entry *_entries;
+	uint32_t _nb_entries;
+	uint32_t _capacity;
+
+	// only one matching frame every _sampling is captured
+	uint32_t _sampling;
+	uint32_t _matched;
+	uint32_t _overflows;
+
+	SummaryTrigger(int, EtherAddress, uint32_t, int16_t, uint16_t, uint32_t, uint32_t, EmpowerLVAPManager *, EmpowerRXStats *);
 	~SummaryTrigger();
 
 	String unparse();
 
+	summary_entry *reserve();
+
+	inline void clear() {
+		_nb_entries = 0;
+	}
+
 	inline bool operator==(const SummaryTrigger &b) {
 		return (_iface == b._iface) && (_eth == b._eth);
 	}
@@ -30,7 +30,8 @@ CLICK_DECLS
 
 Minstrel::Minstrel() 
   : _tx_policies(0), _timer(this), _lookaround_rate(20), _offset(0),
-	_active(true), _period(500), _ewma_level(75), _debug(false) {
+	_active(true), _period(500), _ewma_level(75), _debug(false),
+	_updates(0), _sgi(false) {
 }
 
 Minstrel::~Minstrel() {
@@ -38,76 +39,14 @@ Minstrel::~Minstrel() {
 
 void Minstrel::run_timer(Timer *)
 {
+	Timestamp start = Timestamp::now_steady();
 	for (MinstrelIter iter = _neighbors.begin(); iter.live(); iter++) {
 		MinstrelDstInfo *nfo = &iter.value();
-		int max_tp = 0, index_max_tp = 0, index_max_tp2 = 0;
-		int max_prob = 0, index_max_prob = 0;
-		uint32_t usecs;
-		int i;
-		uint32_t p;
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (_transm_time.find(nfo->rates[i]) == _transm_time.end()) {
-				if (nfo->ht)
-					usecs = calc_usecs_wifi_packet_ht(1500, nfo->rates[i], 0);
-				else
-					usecs = calc_usecs_wifi_packet(1500, nfo->rates[i], 0);
-
-				_transm_time.set(nfo->rates[i], usecs);
-			}
-			else
-			{
-				usecs = _transm_time.get(nfo->rates[i]);
-			}
-			if (!usecs) {
-				usecs = 1000000;
-			}
-			/* To avoid rounding issues, probabilities scale from 0 (0%)
-			 * to 18000 (100%) */
-			if (nfo->attempts[i]) {
-				p = (nfo->successes[i] * 18000) / nfo->attempts[i];
-				nfo->hist_successes[i] += nfo->successes[i];
-				nfo->hist_attempts[i] += nfo->attempts[i];
-				nfo->cur_prob[i] = p;
-				p = ((p * (100 - _ewma_level)) + (nfo->probability[i] * _ewma_level)) / 100;
-				nfo->probability[i] = p;
-				nfo->cur_tp[i] = p * (1000000 / usecs);
-			}
-			nfo->last_successes[i] = nfo->successes[i];
-			nfo->last_attempts[i] = nfo->attempts[i];
-			nfo->successes[i] = 0;
-			nfo->attempts[i] = 0;
-			/* Sample less often below the 10% chance of success.
-			 * Sample less often above the 95% chance of success. */
-			if ((nfo->probability[i] > 17100) || (nfo->probability[i] < 1800)) {
-				nfo->sample_limit[i] = 4;
-			} else {
-				nfo->sample_limit[i] = -1;
-			}
-		}
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (max_tp < nfo->cur_tp[i]) {
-				index_max_tp = i;
-				max_tp = nfo->cur_tp[i];
-			}
-			if (max_prob < nfo->probability[i]) {
-				index_max_prob = i;
-				max_prob = nfo->probability[i];
-			}
-		}
-		max_tp = 0;
-		for (i = 0; i < nfo->rates.size(); i++) {
-			if (i == index_max_tp) {
-				continue;
-			}
-			if (max_tp < nfo->cur_tp[i]) {
-				index_max_tp2 = i;
-				max_tp = nfo->cur_tp[i];
-			}
-		}
-		nfo->max_tp_rate = index_max_tp;
-		nfo->max_tp_rate2 = index_max_tp2;
-		nfo->max_prob_rate = index_max_prob;
+		nfo->update_stats(_ewma_level);
+		nfo->select_rates();
 	}
+	_update_time += Timestamp::now_steady() - start;
+	_updates++;
 	_timer.schedule_after_msec(_period);
 }
 
@@ -129,12 +68,40 @@ int Minstrel::configure(Vector<String> &conf, ErrorHandler *errh)
 		      .read("PERIOD", _period)
 		      .read("ACTIVE",  _active)
 		      .read("DEBUG",  _debug)
+		      .read("SGI",  _sgi)
 		      .complete();
 
+	build_airtime_tables();
+
 	return ret;
 
 }
 
+void Minstrel::build_airtime_tables()
+{
+	static const int legacy_rates[AIRTIME_LEGACY_RATES] = { 2, 4, 11, 22, 12, 18, 24, 36, 48, 72, 96, 108 };
+
+	memset(_legacy_index, -1, sizeof(_legacy_index));
+
+	for (int i = 0; i < AIRTIME_LEGACY_RATES; i++) {
+		_legacy_index[legacy_rates[i]] = i;
+		for (int b = 0; b <= AIRTIME_LEN_BUCKETS; b++) {
+			_airtime_legacy[i][b] = calc_usecs_wifi_packet(b << AIRTIME_LEN_SHIFT, legacy_rates[i], 0);
+		}
+	}
+
+	for (int mcs = 0; mcs < AIRTIME_HT_MCS; mcs++) {
+		for (int b = 0; b <= AIRTIME_LEN_BUCKETS; b++) {
+			int length = b << AIRTIME_LEN_SHIFT;
+			uint32_t usecs = calc_usecs_wifi_packet_ht(length, mcs, 0);
+			// a short guard interval shortens the data symbols by 1/10th
+			uint32_t data = calc_transmit_time_ht(mcs, length) - WIFI_PLCP_HEADER_N;
+			_airtime_ht[0][mcs][b] = usecs;
+			_airtime_ht[1][mcs][b] = usecs - data / 10;
+		}
+	}
+}
+
 void Minstrel::process_feedback(Packet *p_in) {
 	if (!p_in) {
 		return;
@@ -185,16 +152,16 @@ void Minstrel::assign_rate(Packet *p_in)
 
 	memset((void*)ceh, 0, sizeof(struct click_wifi_extra));
 
-	TxPolicyInfo * tx_policy = _tx_policies->supported(dst);
+	// single lookup, fall back to the default policy (same as lookup())
+	TxPolicyInfo * tx_policy = _tx_policies->tx_table()->find(dst);
+	TxPolicyInfo * policy = tx_policy ? tx_policy : _tx_policies->default_tx_policy();
 	if (dst.is_group()) {
 		ceh->flags |= WIFI_EXTRA_TX_NOACK;
-		if(!tx_policy || tx_policy->_ht_mcs.size() == 0) {
-			Vector<int> rates = _tx_policies->lookup(dst)->_mcs;
-			ceh->rate = (rates.size()) ? rates[0] : 2;
+		if(!tx_policy || tx_policy->_ht_rate_set.empty()) {
+			ceh->rate = policy->_rate_set._basic;
 		}
 		else {
-			Vector<int> ht_rates = _tx_policies->lookup(dst)->_ht_mcs;
-			ceh->rate = (ht_rates.size()) ? ht_rates[0] : 2;
+			ceh->rate = tx_policy->_ht_rate_set._basic;
 			ceh->flags |= WIFI_EXTRA_MCS;
 		}
 
@@ -217,8 +184,7 @@ void Minstrel::assign_rate(Packet *p_in)
 		if (subtype == WIFI_FC0_SUBTYPE_BEACON || subtype == WIFI_FC0_SUBTYPE_PROBE_RESP) {
 			ceh->flags |= WIFI_EXTRA_TX_NOACK;
 		}
-		Vector<int> rates = _tx_policies->lookup(dst)->_mcs;
-		ceh->rate = (rates.size()) ? rates[0] : 2;
+		ceh->rate = policy->_rate_set._basic;
 		ceh->rate1 = -1;
 		ceh->rate2 = -1;
 		ceh->rate3 = -1;
@@ -231,7 +197,7 @@ void Minstrel::assign_rate(Packet *p_in)
 
 	MinstrelDstInfo *nfo = _neighbors.findp(dst);
 
-	if (!nfo || !nfo->rates.size()) {
+	if (!nfo || !nfo->nb_rates) {
 		if (_debug) {
 			click_chatter("%{element} :: %s :: adding %s",
 					this, 
@@ -245,8 +211,7 @@ void Minstrel::assign_rate(Packet *p_in)
 						__func__,
 						dst.unparse().c_str());
 			}
-			Vector<int> rates = _tx_policies->lookup(dst)->_mcs;
-			ceh->rate = (rates.size()) ? rates[0] : 2;
+			ceh->rate = policy->_rate_set._basic;
 			ceh->rate1 = -1;
 			ceh->rate2 = -1;
 			ceh->rate3 = -1;
@@ -256,11 +221,11 @@ void Minstrel::assign_rate(Packet *p_in)
 			ceh->max_tries3 = 0;
 			return;
 		}
-		if (tx_policy->_ht_mcs.size()) {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_ht_mcs, true));
+		if (!tx_policy->_ht_rate_set.empty()) {
+			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_ht_rate_set, true));
 			nfo = _neighbors.findp(dst);
 		} else {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_mcs, false));
+			_neighbors.insert(dst, MinstrelDstInfo(dst, tx_policy->_rate_set, false));
 			nfo = _neighbors.findp(dst);
 		}
 	}
@@ -279,8 +244,8 @@ void Minstrel::assign_rate(Packet *p_in)
 			nfo->sample_count = 0;
 			nfo->packet_count = 0;
 		}
-		if (nfo->rates.size() > 0) {
-			int sample_ndx = click_random(0, nfo->rates.size() - 1);
+		if (nfo->nb_rates > 0) {
+			int sample_ndx = click_random(0, nfo->nb_rates - 1);
 			if (nfo->sample_limit[sample_ndx] != 0) {
 				sample = true;
 				ndx = sample_ndx;
@@ -303,6 +268,9 @@ void Minstrel::assign_rate(Packet *p_in)
 
 	if (nfo->ht) {
 		ceh->flags |= WIFI_EXTRA_MCS;
+		if (_sgi) {
+			ceh->flags |= WIFI_EXTRA_MCS_SGI;
+		}
 	}
 
 	if (sample) {
@@ -362,7 +330,7 @@ String Minstrel::print_rates()
 }
 
 enum {
-	H_RATES, H_DEBUG
+	H_RATES, H_DEBUG, H_UPDATE_TIME
 };
 
 String Minstrel::read_handler(Element *e, void *thunk) {
@@ -372,6 +340,14 @@ String Minstrel::read_handler(Element *e, void *thunk) {
 		return String(c->_debug) + "\n";
 	case H_RATES:
 		return c->print_rates();
+	case H_UPDATE_TIME: {
+		StringAccum sa;
+		double usecs = c->_update_time.doubleval() * 1e6;
+		sa << "updates " << c->_updates << "\n";
+		sa << "total " << usecs << "\n";
+		sa << "average " << (c->_updates ? usecs / c->_updates : 0) << "\n";
+		return sa.take_string();
+	}
 	default:
 		return "<error>\n";
 	}
@@ -388,6 +364,11 @@ int Minstrel::write_handler(const String &in_s, Element *e, void *vparam, ErrorH
 		d->_debug = debug;
 		break;
 	}
+	case H_UPDATE_TIME: {
+		d->_updates = 0;
+		d->_update_time = Timestamp();
+		break;
+	}
 	}
 	return 0;
 }
@@ -396,6 +377,8 @@ void Minstrel::add_handlers() {
 	add_read_handler("rates", read_handler, H_RATES);
 	add_read_handler("debug", read_handler, H_DEBUG);
 	add_write_handler("debug", write_handler, H_DEBUG);
+	add_read_handler("update_time", read_handler, H_UPDATE_TIME);
+	add_write_handler("update_time", write_handler, H_UPDATE_TIME);
 }
 
 CLICK_ENDDECLS
@@ -5,7 +5,10 @@
 #include <click/bighashmap.hh>
 #include <click/glue.hh>
 #include <click/timer.hh>
+#include <click/timestamp.hh>
 #include <click/hashtable.hh>
+#include <click/packet_anno.hh>
+#include <clicknet/wifi.h>
 #include <elements/wifi/bitrate.hh>
 #include "transmissionpolicies.hh"
 CLICK_DECLS
@@ -15,24 +18,57 @@ CLICK_DECLS
  * Minstrel([, I<KEYWORDS>])
  * =s Wifi
  * Minstrel wireless bit-rate selection algorithm
+ * =d
+ *
+ * Airtime estimates returned by estimate_usecs_wifi_packet are looked up in
+ * per-rate tables (legacy rates, or HT MCS 0-15 with and without short guard
+ * interval) built at configure time, in 64 byte length steps up to 8192
+ * bytes. The estimate is cached in the packet's AIRTIME annotation, which
+ * upstream schedulers must clear when the packet is enqueued. It follows the
+ * Click Wifi extra header, so the rates assigned by Minstrel are kept.
+ *
+ * Keyword arguments are:
+ *
+ * =over 8
+ *
+ * =item SGI
+ *
+ * Boolean. Use the short guard interval for HT stations. Default is false.
+ *
+ * =back
+ *
+ * =h update_time read/write
+ *
+ * Returns the number of periodic statistics updates, the time they took in
+ * total and on average, in usecs. Writing to it clears the counters.
+ *
  * =a SetTXRate, FilterTX
  */
 
 
+/*
+ * Per neighbour statistics are kept as a structure of fixed size arrays
+ * indexed by rate, so that the periodic update in update_stats() and the
+ * rate selection in select_rates() run over contiguous memory and can be
+ * vectorised by the compiler.
+ */
 struct MinstrelDstInfo {
 public:
+	enum { MAX_RATES = TxRateSet::MAX_RATES };
 	EtherAddress eth;
-	Vector<int> rates;
-	Vector<int> successes;
-	Vector<int> attempts;
-	Vector<int> last_successes;
-	Vector<int> last_attempts;
-	Vector<int> hist_successes;
-	Vector<int> hist_attempts;
-	Vector<int> cur_prob;
-	Vector<int> cur_tp;
-	Vector<int> probability;
-	Vector<int> sample_limit;
+	int nb_rates;
+	int rates[MAX_RATES];
+	int tp_scale[MAX_RATES];
+	int successes[MAX_RATES];
+	int attempts[MAX_RATES];
+	int last_successes[MAX_RATES];
+	int last_attempts[MAX_RATES];
+	int hist_successes[MAX_RATES];
+	int hist_attempts[MAX_RATES];
+	int cur_prob[MAX_RATES];
+	int cur_tp[MAX_RATES];
+	int probability[MAX_RATES];
+	int sample_limit[MAX_RATES];
 	int packet_count;
 	int sample_count;
 	int max_tp_rate;
@@ -41,55 +77,99 @@ public:
 	bool ht;
 	MinstrelDstInfo() {
 		eth = EtherAddress();
-		rates = Vector<int>();
-		successes = Vector<int>();
-		attempts = Vector<int>();
-		last_successes = Vector<int>();
-		last_attempts = Vector<int>();
-		hist_successes = Vector<int>();
-		hist_attempts = Vector<int>();
-		cur_prob = Vector<int>();
-		cur_tp = Vector<int>();
-		probability = Vector<int>();
-		sample_limit = Vector<int>();
-		packet_count = 0;
-		sample_count = 0;
-		max_tp_rate = 0;
-		max_tp_rate2 = 0;
-		max_prob_rate = 0;
+		nb_rates = 0;
+		reset();
 		ht = false;
 	}
-	MinstrelDstInfo(EtherAddress neighbor, Vector<int> supported, bool ht_rates) {
+	MinstrelDstInfo(EtherAddress neighbor, const TxRateSet &supported, bool ht_rates) {
 		eth = neighbor;
-		for (int i = 0; i < supported.size(); i++) {
-			rates.push_back(supported[i]);
+		ht = ht_rates;
+		nb_rates = supported._nb_rates;
+		for (int i = 0; i < nb_rates; i++) {
+			rates[i] = supported._rates[i];
+		}
+		reset();
+	}
+	void reset() {
+		memset(rates + nb_rates, 0, (MAX_RATES - nb_rates) * sizeof(int));
+		memset(successes, 0, sizeof(successes));
+		memset(attempts, 0, sizeof(attempts));
+		memset(last_successes, 0, sizeof(last_successes));
+		memset(last_attempts, 0, sizeof(last_attempts));
+		memset(hist_successes, 0, sizeof(hist_successes));
+		memset(hist_attempts, 0, sizeof(hist_attempts));
+		memset(cur_prob, 0, sizeof(cur_prob));
+		memset(cur_tp, 0, sizeof(cur_tp));
+		memset(probability, 0, sizeof(probability));
+		memset(sample_limit, -1, sizeof(sample_limit));
+		/* throughput is scaled by the number of 1500 byte frames per second */
+		for (int i = 0; i < MAX_RATES; i++) {
+			uint32_t usecs = 0;
+			if (i < nb_rates) {
+				usecs = ht ? calc_usecs_wifi_packet_ht(1500, rates[i], 0)
+						   : calc_usecs_wifi_packet(1500, rates[i], 0);
+			}
+			tp_scale[i] = 1000000 / (usecs ? usecs : 1000000);
 		}
-		successes = Vector<int>(supported.size(), 0);
-		attempts = Vector<int>(supported.size(), 0);
-		last_successes = Vector<int>(supported.size(), 0);
-		last_attempts = Vector<int>(supported.size(), 0);
-		hist_successes = Vector<int>(supported.size(), 0);
-		hist_attempts = Vector<int>(supported.size(), 0);
-		cur_prob = Vector<int>(supported.size(), 0);
-		cur_tp = Vector<int>(supported.size(), 0);
-		probability = Vector<int>(supported.size(), 0);
-		sample_limit = Vector<int>(supported.size(), -1);
 		packet_count = 0;
 		sample_count = 0;
 		max_tp_rate = 0;
 		max_tp_rate2 = 0;
 		max_prob_rate = 0;
-		ht = ht_rates;
+	}
+	void update_stats(unsigned ewma_level) {
+		const int n = nb_rates;
+		for (int i = 0; i < n; i++) {
+			int att = attempts[i];
+			int succ = att ? successes[i] : 0;
+			/* To avoid rounding issues, probabilities scale from 0 (0%)
+			 * to 18000 (100%). The quotient is exact in double precision
+			 * and, unlike the integer divide, can be vectorised. */
+			uint32_t p = (uint32_t) ((double) succ * 18000 / (att ? att : 1));
+			uint32_t ewma = ((p * (100 - ewma_level)) + (probability[i] * ewma_level)) / 100;
+			cur_prob[i] = att ? p : cur_prob[i];
+			probability[i] = att ? ewma : probability[i];
+			cur_tp[i] = att ? ewma * tp_scale[i] : cur_tp[i];
+			hist_successes[i] += succ;
+			hist_attempts[i] += att;
+			last_successes[i] = successes[i];
+			last_attempts[i] = att;
+			successes[i] = 0;
+			attempts[i] = 0;
+			/* Sample less often below the 10% chance of success.
+			 * Sample less often above the 95% chance of success. */
+			sample_limit[i] = (probability[i] > 17100 || probability[i] < 1800) ? 4 : -1;
+		}
+	}
+	void select_rates() {
+		int tp1 = 0, tp2 = 0, prob = 0;
+		int index_tp1 = 0, index_tp2 = 0, index_prob = 0;
+		/* single pass top-2 throughput and top-1 probability, ties go
+		 * to the lowest index */
+		for (int i = 0; i < nb_rates; i++) {
+			int tp = cur_tp[i];
+			bool first = tp > tp1;
+			bool second = !first && tp > tp2;
+			index_tp2 = first ? index_tp1 : (second ? i : index_tp2);
+			tp2 = first ? tp1 : (second ? tp : tp2);
+			index_tp1 = first ? i : index_tp1;
+			tp1 = first ? tp : tp1;
+			index_prob = probability[i] > prob ? i : index_prob;
+			prob = probability[i] > prob ? probability[i] : prob;
+		}
+		max_tp_rate = index_tp1;
+		max_tp_rate2 = index_tp2;
+		max_prob_rate = index_prob;
 	}
 	int rate_index(int rate) {
 		int ndx = -1;
-		for (int x = 0; x < rates.size(); x++) {
+		for (int x = 0; x < nb_rates; x++) {
 			if (rate == rates[x]) {
 				ndx = x;
 				break;
 			}
 		}
-		return (ndx == rates.size()) ? -1 : ndx;
+		return ndx;
 	}
 	void add_result(int rate, int tries, int success) {
 		int ndx = rate_index(rate);
@@ -104,7 +184,7 @@ public:
 		char buffer[4096];
 		sa << eth << "\n";
 		sa << "rate    throughput    ewma prob    this prob    this success (attempts)    success    attempts\n";
-		for (int i = 0; i < rates.size(); i++) {
+		for (int i = 0; i < nb_rates; i++) {
 			tp = cur_tp[i] / ((18000 << 10) / 96);
 			prob = cur_prob[i] / 18;
 			eprob = probability[i] / 18;
@@ -150,9 +230,6 @@ public:
 typedef HashMap<EtherAddress, MinstrelDstInfo> MinstrelNeighborTable;
 typedef MinstrelNeighborTable::iterator MinstrelIter;
 
-typedef HashTable<uint8_t, uint32_t> TTime;
-typedef TTime::iterator TTimeIter;
-
 class Minstrel : public Element { public:
 
 	Minstrel();
@@ -178,18 +255,26 @@ class Minstrel : public Element { public:
 	void process_feedback(Packet *);
 
 	inline uint32_t estimate_usecs_wifi_packet(Packet *p) {
+		uint32_t usecs = AIRTIME_ANNO(p);
+		if (usecs) {
+			return usecs;
+		}
 		struct click_wifi *w = (struct click_wifi *) p->data();
 		EtherAddress dst = EtherAddress(w->i_addr1);
 		if (!dst.is_broadcast() && !dst.is_group()) {
-			uint32_t rate = 1;
 			MinstrelDstInfo *nfo = _neighbors.findp(dst);
-			if (nfo) {
-				rate = nfo->rates[nfo->max_tp_rate];
+			if (nfo && nfo->ht) {
+				usecs = airtime_ht(p->length(), nfo->rates[nfo->max_tp_rate]);
+			} else if (nfo) {
+				usecs = airtime_legacy(p->length(), nfo->rates[nfo->max_tp_rate]);
+			} else {
+				usecs = airtime_legacy(p->length(), 1);
 			}
-			return calc_usecs_wifi_packet(p->length(), rate, 0);
 		} else {
-			return calc_usecs_wifi_packet(p->length(), 1, 0);
+			usecs = airtime_legacy(p->length(), 1);
 		}
+		SET_AIRTIME_ANNO(p, usecs);
+		return usecs;
 	}
 
 	MinstrelNeighborTable * neighbors() { return &_neighbors; }
@@ -198,11 +283,11 @@ class Minstrel : public Element { public:
 
 	MinstrelDstInfo * insert_neighbor(EtherAddress dst, TxPolicyInfo * txp) {
 		MinstrelDstInfo *nfo;
-		if (txp->_ht_mcs.size()) {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, txp->_ht_mcs, true));
+		if (!txp->_ht_rate_set.empty()) {
+			_neighbors.insert(dst, MinstrelDstInfo(dst, txp->_ht_rate_set, true));
 			nfo = _neighbors.findp(dst);
 		} else {
-			_neighbors.insert(dst, MinstrelDstInfo(dst, txp->_mcs, false));
+			_neighbors.insert(dst, MinstrelDstInfo(dst, txp->_rate_set, false));
 			nfo = _neighbors.findp(dst);
 		}
 		return nfo;
@@ -213,7 +298,6 @@ private:
 	MinstrelNeighborTable _neighbors;
 	TransmissionPolicies * _tx_policies;
 	Timer _timer;
-	TTime _transm_time;
 
 	unsigned _lookaround_rate;
 	unsigned _offset;
@@ -222,6 +306,39 @@ private:
 	unsigned _ewma_level;
 	bool _debug;
 
+	uint32_t _updates;
+	Timestamp _update_time;
+
+	enum { AIRTIME_LEN_SHIFT = 6, AIRTIME_LEN_BUCKETS = 128,
+		   AIRTIME_LEGACY_RATES = 12, AIRTIME_MAX_RATE = 108,
+		   AIRTIME_HT_MCS = 16 };
+
+	bool _sgi;
+
+	// usecs indexed by [rate][length bucket], bucket b covers b * 64 bytes
+	int8_t _legacy_index[AIRTIME_MAX_RATE + 1];
+	uint32_t _airtime_legacy[AIRTIME_LEGACY_RATES][AIRTIME_LEN_BUCKETS + 1];
+	uint32_t _airtime_ht[2][AIRTIME_HT_MCS][AIRTIME_LEN_BUCKETS + 1];
+
+	void build_airtime_tables();
+
+	inline uint32_t airtime_legacy(int length, int rate) {
+		uint32_t bucket = (length + (1 << AIRTIME_LEN_SHIFT) - 1) >> AIRTIME_LEN_SHIFT;
+		if (bucket <= AIRTIME_LEN_BUCKETS && rate >= 0 &&
+			rate <= AIRTIME_MAX_RATE && _legacy_index[rate] >= 0) {
+			return _airtime_legacy[_legacy_index[rate]][bucket];
+		}
+		return calc_usecs_wifi_packet(length, rate, 0);
+	}
+
+	inline uint32_t airtime_ht(int length, int mcs) {
+		uint32_t bucket = (length + (1 << AIRTIME_LEN_SHIFT) - 1) >> AIRTIME_LEN_SHIFT;
+		if (bucket <= AIRTIME_LEN_BUCKETS && mcs >= 0 && mcs < AIRTIME_HT_MCS) {
+			return _airtime_ht[_sgi][mcs][bucket];
+		}
+		return calc_usecs_wifi_packet_ht(length, mcs, 0);
+	}
+
 	static int write_handler(const String &, Element *, void *, ErrorHandler *);
 	static String read_handler(Element *, void *);
 
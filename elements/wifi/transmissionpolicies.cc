@@ -76,6 +76,7 @@ int TransmissionPolicies::configure(Vector<String> &conf, ErrorHandler *errh) {
 	if (!_default_tx_policy) {
 		_default_tx_policy = new TxPolicyInfo();
 		_default_tx_policy->_mcs.push_back(2);
+		_default_tx_policy->update_rate_sets();
 	}
 
 	return res;
@@ -171,6 +172,8 @@ int TransmissionPolicies::insert(EtherAddress eth, Vector<int> mcs, Vector<int>
 		dst->_ht_mcs = ht_mcs;
 	}
 
+	dst->update_rate_sets();
+
 	return 0;
 
 }
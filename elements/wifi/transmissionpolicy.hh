@@ -8,6 +8,7 @@
 #include <click/bighashmap.hh>
 #include <click/straccum.hh>
 #include <click/glue.hh>
+#include <click/integers.hh>
 CLICK_DECLS
 
 /*
@@ -26,8 +27,73 @@ Tracks a list of bitrates other stations are capable of.
 =a BeaconScanner
  */
 
-typedef HashTable<uint16_t, uint32_t> CBytes;
-typedef CBytes::iterator CBytesIter;
+/*
+ * Frame length histogram: one bucket for frames shorter than 64 bytes, two
+ * linear buckets per power of two up to 2047 bytes and one bucket for
+ * longer frames, plus packet and byte totals. Each bucket also counts its
+ * bytes, so that it can be reported with the mean length of its frames.
+ */
+class FrameHistogram {
+public:
+
+	enum { NB_BUCKETS = 12, MIN_SHIFT = 6, MAX_SHIFT = 11 };
+
+	uint32_t _buckets[NB_BUCKETS];
+	uint64_t _bucket_bytes[NB_BUCKETS];
+	uint32_t _packets;
+	uint64_t _bytes;
+
+	FrameHistogram() : _packets(0), _bytes(0) {
+		memset(_buckets, 0, sizeof(_buckets));
+		memset(_bucket_bytes, 0, sizeof(_bucket_bytes));
+	}
+
+	static int bucket(uint32_t len) {
+		if (len < (1 << MIN_SHIFT)) {
+			return 0;
+		}
+		if (len >= (1 << MAX_SHIFT)) {
+			return NB_BUCKETS - 1;
+		}
+		// index of the most significant bit, ffs_msb() counts from the top
+		int msb = 31 - __builtin_clz(len);
+		return 1 + ((msb - MIN_SHIFT) << 1) + ((len >> (msb - 1)) & 1);
+	}
+
+	// smallest frame length counted in bucket b
+	static uint16_t lower_bound(int b) {
+		if (b == 0) {
+			return 0;
+		}
+		int shift = MIN_SHIFT + ((b - 1) >> 1);
+		return (1 << shift) + (((b - 1) & 1) << (shift - 1));
+	}
+
+	void update(uint16_t len) {
+		int b = bucket(len);
+		_buckets[b]++;
+		_bucket_bytes[b] += len;
+		_packets++;
+		_bytes += len;
+	}
+
+	// mean frame length of bucket b, rounded to the nearest byte
+	uint16_t mean_length(int b) const {
+		if (!_buckets[b]) {
+			return lower_bound(b);
+		}
+		return (_bucket_bytes[b] + _buckets[b] / 2) / _buckets[b];
+	}
+
+	int nb_used() const {
+		int n = 0;
+		for (int i = 0; i < NB_BUCKETS; i++) {
+			n += (_buckets[i] != 0);
+		}
+		return n;
+	}
+
+};
 
 
 enum empower_tx_mcast_type {
@@ -36,17 +102,49 @@ enum empower_tx_mcast_type {
 	TX_MCAST_UR = 0x2,
 };
 
+/*
+ * Immutable copy of a rate list for the TX path: rates are kept inline, so
+ * that Minstrel neighbours are created without walking a Vector, and the
+ * rate used for management and group addressed frames (the first one) is
+ * precomputed.
+ */
+class TxRateSet {
+public:
+
+	enum { MAX_RATES = 32 };
+
+	uint8_t _rates[MAX_RATES];
+	uint8_t _nb_rates;
+	uint8_t _basic;
+
+	TxRateSet() : _nb_rates(0), _basic(2) {
+	}
+
+	void assign(const Vector<int> &rates) {
+		_nb_rates = 0;
+		_basic = rates.size() ? rates[0] : 2;
+		for (int i = 0; i < rates.size() && i < MAX_RATES; i++) {
+			_rates[_nb_rates++] = rates[i];
+		}
+	}
+
+	bool empty() const { return _nb_rates == 0; }
+
+};
+
 class TxPolicyInfo {
 public:
 
 	Vector<int> _mcs;
 	Vector<int> _ht_mcs;
+	TxRateSet _rate_set;
+	TxRateSet _ht_rate_set;
 	bool _no_ack;
 	empower_tx_mcast_type _tx_mcast;
 	int _ur_mcast_count;
 	int _rts_cts;
-	CBytes _tx;
-	CBytes _rx;
+	FrameHistogram _tx;
+	FrameHistogram _rx;
 
 	TxPolicyInfo() {
 		_mcs = Vector<int>();
@@ -57,6 +155,12 @@ public:
 		_ur_mcast_count = 3;
 	}
 
+	// must be called whenever _mcs or _ht_mcs change
+	void update_rate_sets() {
+		_rate_set.assign(_mcs);
+		_ht_rate_set.assign(_ht_mcs);
+	}
+
 	TxPolicyInfo(Vector<int> mcs, Vector<int> ht_mcs, bool no_ack, empower_tx_mcast_type tx_mcast,
 			int ur_mcast_count, int rts_cts) {
 
@@ -66,20 +170,15 @@ public:
 		_tx_mcast = tx_mcast;
 		_rts_cts = rts_cts;
 		_ur_mcast_count = ur_mcast_count;
+		update_rate_sets();
 	}
 
 	void update_tx(uint16_t len) {
-		if (_tx.find(len) == _tx.end()) {
-			_tx.set(len, 0);
-		}
-		(*_tx.get_pointer(len))++;
+		_tx.update(len);
 	}
 
 	void update_rx(uint16_t len) {
-		if (_rx.find(len) == _rx.end()) {
-			_rx.set(len, 0);
-		}
-		(*_rx.get_pointer(len))++;
+		_rx.update(len);
 	}
 
 	String unparse() {
@@ -134,4 +134,10 @@
 # endif
 #endif
 
+// bytes 44-47, right after the Click Wifi extra header
+#define AIRTIME_ANNO_OFFSET		44
+#define AIRTIME_ANNO_SIZE		4
+#define AIRTIME_ANNO(p)			((p)->anno_u32(AIRTIME_ANNO_OFFSET))
+#define SET_AIRTIME_ANNO(p, v)		((p)->set_anno_u32(AIRTIME_ANNO_OFFSET, (v)))
+
 #endif